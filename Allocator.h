@@ -0,0 +1,67 @@
+#ifndef JPEGINCPLUSPLUS_ALLOCATOR_H
+#define JPEGINCPLUSPLUS_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Where the decoder's large working buffers come from. A service can hand a
+// DecoderContext an arena or a pool of pre-faulted pages; without one, buffers
+// come from operator new. allocate() must return memory aligned for any type,
+// and may return nullptr or throw std::bad_alloc when it runs out.
+class Allocator {
+public:
+    virtual ~Allocator() = default;
+
+    virtual void* allocate(std::size_t size) = 0;
+    virtual void deallocate(void* pointer, std::size_t size) = 0;
+};
+
+// standard allocator over an optional Allocator, so buffers can stay std::vectors
+template <typename T>
+class BufferAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    BufferAllocator(Allocator* const source = nullptr) noexcept : source(source) {}
+
+    template <typename U>
+    BufferAllocator(const BufferAllocator<U>& other) noexcept : source(other.source) {}
+
+    T* allocate(const std::size_t count) {
+        if (source == nullptr)
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        void* const pointer = source->allocate(count * sizeof(T));
+        if (pointer == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(pointer);
+    }
+
+    void deallocate(T* const pointer, const std::size_t count) noexcept {
+        if (source == nullptr)
+            ::operator delete(pointer);
+        else
+            source->deallocate(pointer, count * sizeof(T));
+    }
+
+    Allocator* source;
+};
+
+template <typename T, typename U>
+bool operator==(const BufferAllocator<T>& a, const BufferAllocator<U>& b) {
+    return a.source == b.source;
+}
+
+template <typename T, typename U>
+bool operator!=(const BufferAllocator<T>& a, const BufferAllocator<U>& b) {
+    return a.source != b.source;
+}
+
+template <typename T>
+using Buffer = std::vector<T, BufferAllocator<T>>;
+
+#endif //JPEGINCPLUSPLUS_ALLOCATOR_H
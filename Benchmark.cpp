@@ -0,0 +1,627 @@
+#include "Decoder.h"
+#include "IDCT.h"
+#include "ColorConvert.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+// Times each decoder stage separately on sample1.jfif and on generated images.
+//
+// Every repetition reads the file and decodes it to a BMP through a DecoderContext,
+// exactly as the command line tool does, and takes the per-stage times from the
+// DecodeStats the decoder fills in. ns/pixel and MB/s are relative to the decoded
+// image, i.e. outputWidth * outputHeight * components bytes, so stages can be
+// compared with each other. Per-stage times need JPEG_ENABLE_STATS; without it
+// only the total is measured.
+
+// stages in pipeline order
+enum Stage {
+    Read,
+    Parse,
+    Huffman,
+    IDCT,
+    Color,
+    Write,
+    numStages
+};
+
+const char* const stageNames[numStages] = {"read", "parse", "huffman", "dequantIDCT", "color", "write"};
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(const Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// ---- synthetic input ----
+
+// the example tables of ITU T.81 Annex K
+const unsigned char luminanceQuantization[64] = {
+        16, 11, 10, 16, 24, 40, 51, 61,
+        12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56,
+        14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77,
+        24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99
+};
+
+const unsigned char chrominanceQuantization[64] = {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99
+};
+
+const unsigned char dcCodeLengths[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const unsigned char acCodeLengths[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+// the 37 AC symbols with codes shorter than 16 bits; the rest follow in ascending order
+const unsigned char acShortSymbols[37] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13,
+        0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42,
+        0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72, 0x82
+};
+
+struct HuffmanCode {
+    unsigned short code = 0;
+    unsigned char length = 0;
+};
+
+// canonical codes for symbols listed in order of code length
+void buildCodes(const unsigned char* const codeLengths, const std::vector<unsigned char>& symbols, HuffmanCode* const codes) {
+    unsigned int code = 0;
+    unsigned int k = 0;
+    for (unsigned int length = 1; length <= 16; ++length) {
+        for (unsigned int i = 0; i < codeLengths[length - 1]; ++i, ++k) {
+            codes[symbols[k]].code = (unsigned short) code++;
+            codes[symbols[k]].length = (unsigned char) length;
+        }
+        code <<= 1;
+    }
+}
+
+// MSB-first bit packer with byte stuffing
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : out(out) {}
+
+    void write(const unsigned int bits, const unsigned int length) {
+        for (unsigned int i = length; i-- > 0;) {
+            buffer = (buffer << 1) | ((bits >> i) & 1);
+            if (++count == 8) {
+                out.push_back((unsigned char) buffer);
+                if (buffer == 0xFF)
+                    out.push_back(0x00);
+                buffer = 0;
+                count = 0;
+            }
+        }
+    }
+
+    // pad the last byte with ones
+    void flush() {
+        if (count != 0)
+            write(0x7F, 8 - count);
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    unsigned int buffer = 0;
+    unsigned int count = 0;
+};
+
+unsigned int bitLength(unsigned int value) {
+    unsigned int length = 0;
+    while (value != 0) {
+        ++length;
+        value >>= 1;
+    }
+    return length;
+}
+
+// small deterministic generator so every run benchmarks the same bytes
+struct Random {
+    unsigned int state;
+
+    explicit Random(const unsigned int seed) : state(seed) {}
+
+    unsigned int next() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+
+    // uniform in [0, 1)
+    double uniform() {
+        return next() / 16777216.0;
+    }
+};
+
+// quantized coefficients in zigzag order shaped roughly like a photograph:
+// a smoothly varying DC and a handful of mostly small low frequency AC terms
+void makeBlock(Random& random, const int dc, int* const block) {
+    block[0] = dc;
+    for (unsigned int k = 1; k < 64; ++k) {
+        block[k] = 0;
+        if (random.uniform() < 0.7 * std::exp(-(double) k / 6.0)) {
+            const int magnitude = 1 + (int) (random.uniform() * random.uniform() * 12.0 / (1.0 + k / 8.0));
+            block[k] = (random.next() & 1) ? magnitude : -magnitude;
+        }
+    }
+}
+
+void encodeBlock(BitWriter& writer, const int* const block, int& previousDC, const HuffmanCode* const dcCodes, const HuffmanCode* const acCodes) {
+    const int difference = block[0] - previousDC;
+    previousDC = block[0];
+    unsigned int length = bitLength((unsigned int) std::abs(difference));
+    writer.write(dcCodes[length].code, dcCodes[length].length);
+    writer.write(difference < 0 ? difference - 1 : difference, length);
+
+    unsigned int run = 0;
+    for (unsigned int k = 1; k < 64; ++k) {
+        if (block[k] == 0) {
+            ++run;
+            continue;
+        }
+        for (; run >= 16; run -= 16)
+            writer.write(acCodes[0xF0].code, acCodes[0xF0].length);
+        length = bitLength((unsigned int) std::abs(block[k]));
+        const unsigned int symbol = (run << 4) | length;
+        writer.write(acCodes[symbol].code, acCodes[symbol].length);
+        writer.write(block[k] < 0 ? block[k] - 1 : block[k], length);
+        run = 0;
+    }
+    if (run != 0)
+        writer.write(acCodes[0x00].code, acCodes[0x00].length);
+}
+
+void putMarker(std::vector<unsigned char>& out, const unsigned char marker, const unsigned int length) {
+    out.push_back(0xFF);
+    out.push_back(marker);
+    out.push_back((unsigned char) (length >> 8));
+    out.push_back((unsigned char) length);
+}
+
+// a baseline JPEG of the given size; numComponents is 1 or 3, chroma is subsampled
+// by horizontalFactor x verticalFactor (1 or 2 each)
+std::vector<unsigned char> makeJPEG(const unsigned int width, const unsigned int height, const unsigned int numComponents,
+                                    const unsigned int horizontalFactor, const unsigned int verticalFactor) {
+    std::vector<unsigned char> out = {0xFF, SOI};
+
+    for (unsigned int i = 0; i < 2; ++i) {
+        putMarker(out, DQT, 2 + 65);
+        out.push_back((unsigned char) i);
+        for (unsigned int k = 0; k < 64; ++k)
+            out.push_back((i == 0 ? luminanceQuantization : chrominanceQuantization)[zigZagMap[k]]);
+    }
+
+    putMarker(out, SOF0, 8 + 3 * numComponents);
+    out.push_back(8);
+    out.push_back((unsigned char) (height >> 8));
+    out.push_back((unsigned char) height);
+    out.push_back((unsigned char) (width >> 8));
+    out.push_back((unsigned char) width);
+    out.push_back((unsigned char) numComponents);
+    for (unsigned int i = 0; i < numComponents; ++i) {
+        out.push_back((unsigned char) (i + 1));
+        out.push_back(i == 0 && numComponents == 3 ? (unsigned char) ((horizontalFactor << 4) | verticalFactor) : 0x11);
+        out.push_back(i == 0 ? 0 : 1);
+    }
+
+    std::vector<unsigned char> dcSymbols, acSymbols(acShortSymbols, acShortSymbols + 37);
+    for (unsigned int i = 0; i < 12; ++i)
+        dcSymbols.push_back((unsigned char) i);
+    for (unsigned int run = 0; run < 16; ++run) {
+        for (unsigned int length = 1; length <= 10; ++length) {
+            const unsigned char symbol = (unsigned char) ((run << 4) | length);
+            if (std::find(acShortSymbols, acShortSymbols + 37, symbol) == acShortSymbols + 37)
+                acSymbols.push_back(symbol);
+        }
+    }
+    std::sort(acSymbols.begin() + 37, acSymbols.end());
+
+    putMarker(out, DHT, 2 + 17 + 12);
+    out.push_back(0x00);
+    out.insert(out.end(), dcCodeLengths, dcCodeLengths + 16);
+    out.insert(out.end(), dcSymbols.begin(), dcSymbols.end());
+    putMarker(out, DHT, 2 + 17 + 162);
+    out.push_back(0x10);
+    out.insert(out.end(), acCodeLengths, acCodeLengths + 16);
+    out.insert(out.end(), acSymbols.begin(), acSymbols.end());
+
+    putMarker(out, SOS, 6 + 2 * numComponents);
+    out.push_back((unsigned char) numComponents);
+    for (unsigned int i = 0; i < numComponents; ++i) {
+        out.push_back((unsigned char) (i + 1));
+        out.push_back(0x00);
+    }
+    out.push_back(0);
+    out.push_back(63);
+    out.push_back(0);
+
+    HuffmanCode dcCodes[256], acCodes[256];
+    buildCodes(dcCodeLengths, dcSymbols, dcCodes);
+    buildCodes(acCodeLengths, acSymbols, acCodes);
+
+    const unsigned int h = numComponents == 3 ? horizontalFactor : 1;
+    const unsigned int v = numComponents == 3 ? verticalFactor : 1;
+    const unsigned int mcuWidth = (width + 8 * h - 1) / (8 * h);
+    const unsigned int mcuHeight = (height + 8 * v - 1) / (8 * v);
+
+    Random random(12345);
+    BitWriter writer(out);
+    int previousDCs[3] = {0, 0, 0};
+    int block[64];
+    for (unsigned int y = 0; y < mcuHeight; ++y) {
+        for (unsigned int x = 0; x < mcuWidth; ++x) {
+            // a diagonal ramp plus a little noise
+            const int base = (int) ((x * 8 * h + y * 8 * v) * 60 / (width + height)) - 30;
+            for (unsigned int i = 0; i < h * v; ++i) {
+                makeBlock(random, base + (int) (random.next() % 5) - 2, block);
+                encodeBlock(writer, block, previousDCs[0], dcCodes, acCodes);
+            }
+            for (unsigned int j = 1; j < numComponents; ++j) {
+                makeBlock(random, (int) (random.next() % 7) - 3, block);
+                encodeBlock(writer, block, previousDCs[j], dcCodes, acCodes);
+            }
+        }
+    }
+    writer.flush();
+
+    out.push_back(0xFF);
+    out.push_back(EOI);
+    return out;
+}
+
+// ---- measurement ----
+
+// what to decode of each image and how, as the command line tool's options
+struct BenchOptions {
+    unsigned int reps = 10;
+    unsigned int numThreads = 1;
+    unsigned int scale = 1;
+    // unless cropWidth is 0, only the cropWidth x cropHeight pixels at (cropX, cropY) after scaling
+    unsigned int cropX = 0;
+    unsigned int cropY = 0;
+    unsigned int cropWidth = 0;
+    unsigned int cropHeight = 0;
+    bool gray = false;
+};
+
+struct Sample {
+    double seconds[numStages] = {0};
+    // wall-clock time of the whole pass
+    double total = 0.0;
+};
+
+struct Statistics {
+    double mean = 0.0;
+    double deviation = 0.0;
+    double minimum = 0.0;
+};
+
+// stage, or the whole pass for numStages
+double sampleSeconds(const Sample& sample, const int stage) {
+    return stage == numStages ? sample.total : sample.seconds[stage];
+}
+
+Statistics summarize(const std::vector<Sample>& samples, const int stage) {
+    Statistics result;
+    result.minimum = sampleSeconds(samples[0], stage);
+    for (const Sample& sample : samples) {
+        result.mean += sampleSeconds(sample, stage);
+        result.minimum = std::min(result.minimum, sampleSeconds(sample, stage));
+    }
+    result.mean /= samples.size();
+    for (const Sample& sample : samples)
+        result.deviation += (sampleSeconds(sample, stage) - result.mean) * (sampleSeconds(sample, stage) - result.mean);
+    result.deviation = samples.size() > 1 ? std::sqrt(result.deviation / (samples.size() - 1)) : 0.0;
+    return result;
+}
+
+// one timed pass over filename through the context, the decoded image going to outFilename
+bool runOnce(DecoderContext& context, const std::string& filename, const std::string& outFilename, const BenchOptions& options,
+             Sample& sample) {
+    const Clock::time_point start = Clock::now();
+    const Header* const header = context.read(filename);
+    if (!header->valid)
+        return false;
+    context.setScale(options.scale);
+    if (options.cropWidth != 0 && !context.setCrop(options.cropX, options.cropY, options.cropWidth, options.cropHeight)) {
+        JPEG_LOG_ERROR("Crop window outside the image");
+        return false;
+    }
+    // the header's stats hold reading and parsing, decoding adds the other stages
+    DecodeStats stats = header->stats;
+
+    BMPWriter writer;
+    bool success;
+    {
+        JPEG_STATS_TIMER(&stats, write);
+        success = writer.open(outFilename, header->outputWidth, header->outputHeight, options.gray || header->numComponents == 1);
+    }
+    if (success)
+        success = context.decode(writer, options.numThreads, &stats) == JPEGError::None;
+    {
+        JPEG_STATS_TIMER(&stats, write);
+        success = writer.close() && success;
+    }
+    sample.total = secondsSince(start);
+
+    sample.seconds[Read] = stats.fileRead;
+    sample.seconds[Parse] = stats.markerParse;
+    sample.seconds[Huffman] = stats.entropyDecode;
+    sample.seconds[IDCT] = stats.dequantIDCT;
+    sample.seconds[Color] = stats.colorConvert;
+    sample.seconds[Write] = stats.write;
+    return success;
+}
+
+bool benchmark(const std::string& filename, const std::string& label, const std::string& outFilename, const BenchOptions& options) {
+    // one context for every pass, so its buffers are reused as the command line tool reuses them
+    DecoderContext context;
+    std::vector<Sample> samples;
+    bool success = true;
+    // the first pass only warms caches and the page cache
+    for (unsigned int i = 0; i <= options.reps && success; ++i) {
+        Sample sample;
+        success = runOnce(context, filename, outFilename, options, sample);
+        if (i != 0)
+            samples.push_back(sample);
+    }
+
+    if (!success) {
+        std::cout << label << ": decoding failed\n";
+        return false;
+    }
+
+    const Header* const header = context.header();
+    const bool gray = options.gray || header->numComponents == 1;
+    const double pixels = (double) header->outputWidth * header->outputHeight;
+    const double bytes = pixels * (gray ? 1 : header->numComponents);
+    std::printf("%s: %ux%u%s, %u component%s, sampling %ux%u, %zu bytes, output %ux%u%s, %u thread%s, %u reps\n", label.c_str(),
+                header->width, header->height, header->frameType == SOF2 ? " progressive" : "", header->numComponents,
+                header->numComponents == 1 ? "" : "s", header->horizontalSamplingFactor, header->verticalSamplingFactor,
+                header->source.size(), header->outputWidth, header->outputHeight, gray ? " gray" : "", options.numThreads,
+                options.numThreads == 1 ? "" : "s", options.reps);
+    std::printf("  %-12s %10s %10s %9s %10s %10s\n", "stage", "mean ms", "min ms", "stddev", "ns/pixel", "MB/s");
+
+    // the total is measured around the whole pass, so it holds with the stage timers compiled out too
+#ifdef JPEG_ENABLE_STATS
+    for (int stage = 0; stage <= numStages; ++stage) {
+#else
+    for (int stage = numStages; stage <= numStages; ++stage) {
+#endif
+        if (stage == Color && gray)
+            continue;
+        const Statistics s = summarize(samples, stage);
+        std::printf("  %-12s %10.3f %10.3f %8.1f%% %10.2f %10.1f\n", stage == numStages ? "total" : stageNames[stage], s.mean * 1e3,
+                    s.minimum * 1e3, s.mean > 0.0 ? 100.0 * s.deviation / s.mean : 0.0, s.mean * 1e9 / pixels, bytes / s.mean / 1e6);
+    }
+    std::printf("\n");
+    return true;
+}
+
+const char* simdName(const SIMDLevel level) {
+    return level == SIMDLevel::AVX2 ? "avx2" : (level == SIMDLevel::SSE2 ? "sse2" : "scalar");
+}
+
+// ---- kernel check ----
+
+const unsigned int verifyBlocks = 3;
+const unsigned int verifyRounds = 100000;
+
+// coefficients and multipliers for round i: random at a few magnitudes, and every so often an
+// edge case (all zero, DC only, everything at the 16-bit limits) the kernels must saturate alike
+void makeVerifyBlocks(Random& random, const unsigned int i, short* const blocks, short* const quantization) {
+    const int range = i % 3 == 0 ? 65536 : (i % 3 == 1 ? 2048 : 64);
+    for (unsigned int k = 0; k < 64 * verifyBlocks; ++k)
+        blocks[k] = (short) ((int) (random.next() % range) - range / 2);
+    for (unsigned int k = 0; k < 64; ++k)
+        quantization[k] = (short) (1 + random.next() % (i % 5 == 0 ? 32767 : 255));
+
+    switch (i % 16) {
+        case 0:
+            std::fill(blocks, blocks + 64 * verifyBlocks, 0);
+            break;
+        case 1:
+            std::fill(blocks, blocks + 64 * verifyBlocks, 0);
+            blocks[0] = (short) (i % 32 == 1 ? 32767 : -32768);
+            blocks[64] = (short) (i % 32 == 1 ? -1024 : 1023);
+            break;
+        case 2:
+            std::fill(blocks, blocks + 64 * verifyBlocks, (short) (i % 32 == 2 ? 32767 : -32768));
+            std::fill(quantization, quantization + 64, (short) 32767);
+            break;
+        case 3:
+            std::fill(quantization, quantization + 64, (short) 1);
+            break;
+        default:
+            break;
+    }
+}
+
+// run every IDCT and color conversion kernel level the CPU supports on the same random and edge-case
+// input as the scalar kernels and count the outputs that differ in any byte
+bool verifyKernels() {
+    const SIMDLevel previousIDCT = getIDCTKernel();
+    const SIMDLevel previousColor = getColorKernel();
+    bool success = true;
+
+    for (const SIMDLevel level : {SIMDLevel::SSE2, SIMDLevel::AVX2}) {
+        if (!supportsSIMDLevel(level))
+            continue;
+
+        Random random(54321);
+        unsigned int idctMismatches = 0;
+        for (unsigned int i = 0; i < verifyRounds; ++i) {
+            short blocks[64 * verifyBlocks];
+            short quantization[64];
+            makeVerifyBlocks(random, i, blocks, quantization);
+            for (const unsigned int size : {8u, 4u, 2u, 1u}) {
+                const std::size_t stride = verifyBlocks * 8;
+                unsigned char expected[8 * verifyBlocks * 8] = {0};
+                unsigned char actual[8 * verifyBlocks * 8] = {0};
+                setIDCTKernel(SIMDLevel::Scalar);
+                inverseDCTBlocksScaled(blocks, verifyBlocks, size, quantization, expected, stride);
+                setIDCTKernel(level);
+                inverseDCTBlocksScaled(blocks, verifyBlocks, size, quantization, actual, stride);
+                idctMismatches += std::memcmp(expected, actual, sizeof(expected)) != 0;
+            }
+        }
+
+        unsigned int colorMismatches = 0;
+        for (unsigned int i = 0; i < verifyRounds / 10; ++i) {
+            // lengths from 8 to 256, so the AVX2 kernel leaves a remainder for SSE2 about half the time
+            const std::size_t length = 8 * (1 + random.next() % 32);
+            const unsigned int chromaFactor = 1 + (i & 1);
+            unsigned char y[256], cb[256], cr[256];
+            for (std::size_t k = 0; k < length; ++k) {
+                // extremes now and then, where clamping kicks in
+                y[k] = (unsigned char) (i % 8 == 0 ? (random.next() & 1) * 255 : random.next());
+                cb[k] = (unsigned char) (i % 8 == 0 ? (random.next() & 1) * 255 : random.next());
+                cr[k] = (unsigned char) (i % 8 == 0 ? (random.next() & 1) * 255 : random.next());
+            }
+            unsigned char expected[3][256], actual[3][256];
+            setColorKernel(SIMDLevel::Scalar);
+            YCbCrToRGBRow(y, cb, cr, expected[0], expected[1], expected[2], length, chromaFactor);
+            setColorKernel(level);
+            YCbCrToRGBRow(y, cb, cr, actual[0], actual[1], actual[2], length, chromaFactor);
+            for (unsigned int c = 0; c < 3; ++c)
+                colorMismatches += std::memcmp(expected[c], actual[c], length) != 0;
+        }
+
+        std::printf("%s: %u IDCT mismatches in %u runs of %u blocks, %u color mismatches in %u rows\n", simdName(level), idctMismatches,
+                    verifyRounds * 4, verifyBlocks, colorMismatches, verifyRounds / 10);
+        success = success && idctMismatches == 0 && colorMismatches == 0;
+    }
+
+    setIDCTKernel(previousIDCT);
+    setColorKernel(previousColor);
+    std::printf(success ? "every kernel matches the scalar ones\n" : "KERNELS DIFFER\n");
+    return success;
+}
+
+// a file in the temporary directory that is removed again on exit
+std::string temporaryFile(std::vector<std::string>& created) {
+    char name[] = "/tmp/jpeg_bench_XXXXXX";
+    const int fd = mkstemp(name);
+    if (fd == -1)
+        return std::string();
+    close(fd);
+    created.push_back(name);
+    return name;
+}
+
+int main(int argc, char* argv[]) {
+    setLogLevel(LogLevel::Error);
+    BenchOptions options;
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg.compare(0, 7, "--reps=") == 0) {
+            options.reps = (unsigned int) std::max(1, std::atoi(arg.c_str() + 7));
+        }
+        else if (arg.compare(0, 10, "--threads=") == 0) {
+            options.numThreads = arg == "--threads=all" ? std::max(1u, std::thread::hardware_concurrency())
+                                                        : (unsigned int) std::max(1, std::atoi(arg.c_str() + 10));
+        }
+        else if (arg.compare(0, 8, "--scale=") == 0) {
+            options.scale = (unsigned int) std::atoi(arg.c_str() + 8);
+            if (options.scale != 1 && options.scale != 2 && options.scale != 4 && options.scale != 8) {
+                std::cout << "Scale must be 1, 2, 4 or 8\n";
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 7, "--crop=") == 0) {
+            char end;
+            if (std::sscanf(arg.c_str() + 7, "%ux%u+%u+%u%c", &options.cropWidth, &options.cropHeight, &options.cropX, &options.cropY,
+                            &end) != 4 || options.cropWidth == 0 || options.cropHeight == 0) {
+                std::cout << "Crop must be WxH+X+Y\n";
+                return 1;
+            }
+        }
+        else if (arg == "--gray") {
+            options.gray = true;
+        }
+        else if (arg == "--verify") {
+            return verifyKernels() ? 0 : 1;
+        }
+        else if (arg.compare(0, 7, "--simd=") == 0) {
+            const std::string name = arg.substr(7);
+            const SIMDLevel level = name == "avx2" ? SIMDLevel::AVX2 : (name == "sse2" ? SIMDLevel::SSE2 : SIMDLevel::Scalar);
+            if ((name != "scalar" && name != "sse2" && name != "avx2") || !setIDCTKernel(level) || !setColorKernel(level)) {
+                std::cout << "SIMD level " << name << " is not available\n";
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            std::cout << "Usage: jpeg_bench [--reps=N] [--threads=N|all] [--scale=N] [--crop=WxH+X+Y] [--gray]\n"
+                         "                  [--simd=scalar|sse2|avx2] [file.jpg...]\n"
+                         "       jpeg_bench --verify   check every SIMD kernel against the scalar ones\n";
+            return 1;
+        }
+        else {
+            filenames.push_back(arg);
+        }
+    }
+    // with no files given, sample1.jfif from the source tree
+    if (filenames.empty() && std::ifstream(JPEG_SOURCE_DIR "/sample1.jfif"))
+        filenames.push_back(JPEG_SOURCE_DIR "/sample1.jfif");
+
+    std::printf("IDCT kernel: %s, color kernel: %s\n\n", simdName(getIDCTKernel()), simdName(getColorKernel()));
+
+    std::vector<std::string> created;
+    const std::string outFilename = temporaryFile(created);
+    if (outFilename.empty()) {
+        std::cout << "Error - Error creating temporary file\n";
+        return 1;
+    }
+
+    bool success = true;
+    for (const std::string& filename : filenames)
+        success = benchmark(filename, filename, outFilename, options) && success;
+
+    struct Synthetic {
+        unsigned int width, height, numComponents, horizontalFactor, verticalFactor;
+    };
+    const Synthetic synthetics[] = {
+            {256, 256, 3, 1, 1},
+            {1024, 768, 3, 2, 2},
+            {1920, 1080, 3, 2, 1},
+            {4096, 4096, 3, 2, 2},
+            {2048, 2048, 1, 1, 1}
+    };
+    for (const Synthetic& synthetic : synthetics) {
+        const std::vector<unsigned char> data = makeJPEG(synthetic.width, synthetic.height, synthetic.numComponents,
+                                                         synthetic.horizontalFactor, synthetic.verticalFactor);
+        const std::string filename = temporaryFile(created);
+        std::ofstream file(filename, std::ios::out | std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        file.close();
+        if (filename.empty() || !file) {
+            std::cout << "Error - Error writing temporary file\n";
+            success = false;
+            continue;
+        }
+        const std::string label = "synthetic " + std::to_string(synthetic.width) + "x" + std::to_string(synthetic.height);
+        success = benchmark(filename, label, outFilename, options) && success;
+    }
+
+    for (const std::string& filename : created)
+        std::remove(filename.c_str());
+    return success ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#ifndef JPEGINCPLUSPLUS_BITREADER_H
+#define JPEGINCPLUSPLUS_BITREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "JPEG.h"
+
+// reads the entropy-coded data MSB first into a 64-bit bit buffer, refilled several bytes at a time
+// byte stuffing is removed on the fly; a marker ends the data until restart() moves past it
+class BitReader {
+public:
+    BitReader(const unsigned char* const data, const std::size_t length) : data(data), length(length) {}
+
+    // return the next length (at most 16) bits without consuming them
+    // past the end of the data or a marker the stream reads as zeros
+    unsigned int peekBits(const unsigned int length) {
+        if (bitCount < length)
+            refill();
+        return (unsigned int) (buffer >> (bitCount - length)) & ((1u << length) - 1);
+    }
+
+    void skipBits(const unsigned int length) {
+        bitCount -= length;
+    }
+
+    unsigned int readBits(const unsigned int length) {
+        if (length == 0)
+            return 0;
+        const unsigned int bits = peekBits(length);
+        skipBits(length);
+        return bits;
+    }
+
+    // drop the rest of the current interval and move past the following RSTN marker
+    // normally only padding bits are left; after corrupt data this resynchronizes on the marker
+    void restart() {
+        overran |= bitCount < paddingBits;
+        buffer = 0;
+        bitCount = 0;
+        paddingBits = 0;
+
+        // skip to the next marker, passing stuffed 0xFF00s and fill bytes
+        while (position + 1 < length && (data[position] != 0xFF || data[position + 1] == 0x00 || data[position + 1] == 0xFF))
+            ++position;
+        if (position + 1 < length && data[position + 1] >= RST0 && data[position + 1] <= RST7)
+            position += 2;
+    }
+
+    // true if more bits were consumed than the data holds
+    bool overrun() const {
+        return overran || bitCount < paddingBits;
+    }
+
+private:
+    // top the buffer up to at least 56 bits
+    void refill() {
+        // as many whole bytes as fit, read at once when none of them is 0xFF (stuffing or a marker)
+        const unsigned int numBytes = (63 - bitCount) / 8;
+        if (position + 8 <= length) {
+            std::uint64_t word = 0;
+            for (unsigned int i = 0; i < 8; ++i)
+                word = (word << 8) | data[position + i];
+            const std::uint64_t bytes = word >> (64 - 8 * numBytes);
+            const std::uint64_t mask = ~(std::uint64_t) 0 >> (64 - 8 * numBytes);
+            // a 0xFF byte of bytes is a zero byte of inverted, found by the borrow it causes
+            const std::uint64_t inverted = ~bytes & mask;
+            if (((inverted - 0x0101010101010101u) & ~inverted & 0x8080808080808080u & mask) == 0) {
+                buffer = (buffer << (8 * numBytes)) | bytes;
+                bitCount += 8 * numBytes;
+                position += numBytes;
+                return;
+            }
+        }
+
+        while (bitCount <= 56) {
+            buffer = (buffer << 8) | nextByte();
+            bitCount += 8;
+        }
+    }
+
+    unsigned int nextByte() {
+        while (position < length) {
+            const unsigned char byte = data[position];
+            if (byte != 0xFF) {
+                ++position;
+                return byte;
+            }
+            if (position + 1 >= length)
+                break;
+
+            const unsigned char next = data[position + 1];
+            // 0xFF00 is a literal 0xFF
+            if (next == 0x00) {
+                position += 2;
+                return 0xFF;
+            }
+            // any number of 0xFF's before a marker are fill bytes
+            if (next != 0xFF)
+                break;
+            ++position;
+        }
+        paddingBits += 8;
+        return 0;
+    }
+
+    const unsigned char* data;
+    std::size_t length;
+    std::size_t position = 0;
+    // the bitCount low bits are the next bits of the stream
+    std::uint64_t buffer = 0;
+    unsigned int bitCount = 0;
+    // zero bits fed in past a marker or the end of the data
+    unsigned int paddingBits = 0;
+    bool overran = false;
+};
+
+#endif //JPEGINCPLUSPLUS_BITREADER_H
@@ -0,0 +1,94 @@
+#include "ByteSource.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <utility>
+
+// chunk size used when the input has to be read rather than mapped
+static const std::size_t readChunkSize = 1 << 20;
+
+ByteSource::~ByteSource() {
+    close();
+}
+
+ByteSource::ByteSource(ByteSource&& other) noexcept {
+    *this = std::move(other);
+}
+
+ByteSource& ByteSource::operator=(ByteSource&& other) noexcept {
+    if (this == &other)
+        return *this;
+    close();
+    // a read buffer's storage moves with the vector, so data stays valid
+    data = other.data;
+    length = other.length;
+    position = other.position;
+    mapped = other.mapped;
+    buffer = std::move(other.buffer);
+    other.data = nullptr;
+    other.length = 0;
+    other.position = 0;
+    other.mapped = false;
+    other.buffer.clear();
+    return *this;
+}
+
+bool ByteSource::open(const std::string& filename) {
+    close();
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* const address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            // the whole file is parsed front to back exactly once
+            madvise(address, info.st_size, MADV_SEQUENTIAL);
+            ::close(fd);
+            data = static_cast<const unsigned char*>(address);
+            length = info.st_size;
+            mapped = true;
+            return true;
+        }
+    }
+
+    // fall back to reading everything for inputs that cannot be mapped
+    std::size_t used = 0;
+    while (true) {
+        if (buffer.size() - used < readChunkSize)
+            buffer.resize(used + readChunkSize);
+        const ssize_t count = ::read(fd, buffer.data() + used, readChunkSize);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0) {
+            ::close(fd);
+            buffer.clear();
+            return false;
+        }
+        if (count == 0)
+            break;
+        used += count;
+    }
+    ::close(fd);
+
+    buffer.resize(used);
+    data = buffer.data();
+    length = used;
+    return true;
+}
+
+void ByteSource::close() {
+    if (mapped)
+        munmap(const_cast<unsigned char*>(data), length);
+    mapped = false;
+    data = nullptr;
+    length = 0;
+    position = 0;
+    // the read buffer keeps its capacity for the next input
+    buffer.clear();
+}
@@ -0,0 +1,69 @@
+#ifndef JPEGINCPLUSPLUS_BYTESOURCE_H
+#define JPEGINCPLUSPLUS_BYTESOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Whole-file input shared by all marker readers. Regular files are memory-mapped;
+// anything that cannot be mapped (pipes, character devices) is read into a buffer
+// in large chunks. get() mirrors std::istream::get(): it returns -1 once the
+// input is exhausted, after which the source tests false.
+class ByteSource {
+public:
+    ByteSource() = default;
+    ~ByteSource();
+
+    ByteSource(const ByteSource&) = delete;
+    ByteSource& operator=(const ByteSource&) = delete;
+
+    // the mapping or buffer changes hands, other is left closed
+    ByteSource(ByteSource&& other) noexcept;
+    ByteSource& operator=(ByteSource&& other) noexcept;
+
+    bool open(const std::string& filename);
+    // unmap or let go of the input; a read buffer keeps its memory until destruction, for the next input
+    void close();
+
+    bool is_open() const {
+        return data != nullptr;
+    }
+
+    int get() {
+        if (position < length)
+            return data[position++];
+        position = length + 1;
+        return -1;
+    }
+
+    // skip count bytes without looking at them
+    void skip(const std::size_t count) {
+        position = (count <= length - position) ? position + count : length + 1;
+    }
+
+    explicit operator bool() const {
+        return position <= length;
+    }
+
+    std::size_t tell() const {
+        return position;
+    }
+
+    std::size_t size() const {
+        return length;
+    }
+
+    const unsigned char* begin() const {
+        return data;
+    }
+
+private:
+    const unsigned char* data = nullptr;
+    std::size_t length = 0;
+    std::size_t position = 0;
+
+    bool mapped = false;
+    std::vector<unsigned char> buffer;
+};
+
+#endif //JPEGINCPLUSPLUS_BYTESOURCE_H
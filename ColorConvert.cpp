@@ -0,0 +1,145 @@
+#include "ColorConvert.h"
+#include "ColorConvertConstants.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// With cb' = cb - 128, cr' = cr - 128 and fix(x) = round(x * 2^16):
+//   r = y + ((fix(1.40200) * cr' + 2^15) >> 16)
+//   g = y + ((-fix(0.34414) * cb' - fix(0.71414) * cr' + 2^15) >> 16)
+//   b = y + ((fix(1.77200) * cb' + 2^15) >> 16)
+// The SIMD kernels split each constant into a multiple of 2^16 and a 16-bit
+// remainder so the products can be formed with pmaddwd on (cb', cr') pairs.
+
+static inline unsigned char clamp(const int value) {
+    return (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+void YCbCrToRGBScalar(const unsigned char* const y, const unsigned char* const cb, const unsigned char* const cr,
+                      unsigned char* const r, unsigned char* const g, unsigned char* const b,
+                      const std::size_t length, const unsigned int chromaFactor) {
+    const unsigned int chromaShift = chromaFactor == 2 ? 1 : 0;
+    for (std::size_t i = 0; i < length; ++i) {
+        const int luma = y[i];
+        const int blue = cb[i >> chromaShift] - 128;
+        const int red = cr[i >> chromaShift] - 128;
+        r[i] = clamp(luma + ((crToR * red + half) >> 16));
+        g[i] = clamp(luma + ((cbToG * blue + crToG * red + half) >> 16));
+        b[i] = clamp(luma + ((cbToB * blue + half) >> 16));
+    }
+}
+
+#if defined(__SSE2__)
+
+// pmaddwd constant: lanes holding (cb', cr') pairs become cb' * a + cr' * b
+static inline __m128i pairConstant(const int a, const int b) {
+    return _mm_set1_epi32((int) (((unsigned int) b << 16) | ((unsigned int) a & 0xFFFF)));
+}
+
+// eight chroma samples widened to 16 bits, each repeated if chroma is subsampled
+template <unsigned int chromaFactor>
+static inline __m128i loadChromaSSE2(const unsigned char* const chroma) {
+    __m128i samples;
+    if (chromaFactor == 2) {
+        int four;
+        std::memcpy(&four, chroma, sizeof(four));
+        samples = _mm_cvtsi32_si128(four);
+        samples = _mm_unpacklo_epi8(samples, samples);
+    }
+    else {
+        samples = _mm_loadl_epi64((const __m128i*) chroma);
+    }
+    return _mm_unpacklo_epi8(samples, _mm_setzero_si128());
+}
+
+// the conversion with the chroma factor fixed, so the loop holds no test of it
+template <unsigned int chromaFactor>
+static void YCbCrToRGBSSE2Fixed(const unsigned char* const y, const unsigned char* const cb, const unsigned char* const cr,
+                                unsigned char* const r, unsigned char* const g, unsigned char* const b, const std::size_t length) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i center = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi32(half);
+
+    // crToR = 2^16 + 26345, crToG = -2^16 + 18734, cbToB = 2^17 - 14942
+    const __m128i toR = pairConstant(0, crToR - 65536);
+    const __m128i toG = pairConstant(cbToG, crToG + 65536);
+    const __m128i toB = pairConstant(cbToB - 131072, 0);
+
+    for (std::size_t i = 0; i < length; i += 8) {
+        const std::size_t c = chromaFactor == 2 ? i / 2 : i;
+        const __m128i luma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (y + i)), zero);
+        const __m128i blue = _mm_sub_epi16(loadChromaSSE2<chromaFactor>(cb + c), center);
+        const __m128i red = _mm_sub_epi16(loadChromaSSE2<chromaFactor>(cr + c), center);
+
+        __m128i channels[3][2];
+        for (unsigned int part = 0; part < 2; ++part) {
+            const __m128i pairs = part ? _mm_unpackhi_epi16(blue, red) : _mm_unpacklo_epi16(blue, red);
+            // red << 16 and blue << 17 as 32-bit lanes
+            const __m128i redShifted = part ? _mm_unpackhi_epi16(zero, red) : _mm_unpacklo_epi16(zero, red);
+            const __m128i blueShifted = _mm_slli_epi32(part ? _mm_unpackhi_epi16(zero, blue) : _mm_unpacklo_epi16(zero, blue), 1);
+            const __m128i luma32 = part ? _mm_unpackhi_epi16(luma, zero) : _mm_unpacklo_epi16(luma, zero);
+
+            const __m128i toRed = _mm_add_epi32(_mm_madd_epi16(pairs, toR), redShifted);
+            const __m128i toGreen = _mm_sub_epi32(_mm_madd_epi16(pairs, toG), redShifted);
+            const __m128i toBlue = _mm_add_epi32(_mm_madd_epi16(pairs, toB), blueShifted);
+
+            channels[0][part] = _mm_add_epi32(luma32, _mm_srai_epi32(_mm_add_epi32(toRed, round), 16));
+            channels[1][part] = _mm_add_epi32(luma32, _mm_srai_epi32(_mm_add_epi32(toGreen, round), 16));
+            channels[2][part] = _mm_add_epi32(luma32, _mm_srai_epi32(_mm_add_epi32(toBlue, round), 16));
+        }
+
+        // packing to unsigned bytes clamps to 0..255
+        unsigned char* const out[3] = {r + i, g + i, b + i};
+        for (unsigned int k = 0; k < 3; ++k) {
+            const __m128i words = _mm_packs_epi32(channels[k][0], channels[k][1]);
+            _mm_storel_epi64((__m128i*) out[k], _mm_packus_epi16(words, words));
+        }
+    }
+}
+
+void YCbCrToRGBSSE2(const unsigned char* const y, const unsigned char* const cb, const unsigned char* const cr,
+                    unsigned char* const r, unsigned char* const g, unsigned char* const b,
+                    const std::size_t length, const unsigned int chromaFactor) {
+    if (chromaFactor == 2)
+        YCbCrToRGBSSE2Fixed<2>(y, cb, cr, r, g, b, length);
+    else
+        YCbCrToRGBSSE2Fixed<1>(y, cb, cr, r, g, b, length);
+}
+
+#endif
+
+static SIMDLevel currentKernel = bestSIMDLevel();
+
+bool setColorKernel(const SIMDLevel level) {
+    if (!supportsSIMDLevel(level))
+        return false;
+    currentKernel = level;
+    return true;
+}
+
+SIMDLevel getColorKernel() {
+    return currentKernel;
+}
+
+void YCbCrToRGBRow(const unsigned char* const y, const unsigned char* const cb, const unsigned char* const cr,
+                   unsigned char* const r, unsigned char* const g, unsigned char* const b,
+                   const std::size_t length, const unsigned int chromaFactor) {
+    std::size_t done = 0;
+#ifdef JPEG_HAVE_AVX2
+    if (currentKernel == SIMDLevel::AVX2) {
+        done = length & ~(std::size_t) 15;
+        YCbCrToRGBAVX2(y, cb, cr, r, g, b, done, chromaFactor);
+    }
+#endif
+    const std::size_t c = chromaFactor == 2 ? done / 2 : done;
+#if defined(__SSE2__)
+    if (currentKernel != SIMDLevel::Scalar) {
+        YCbCrToRGBSSE2(y + done, cb + c, cr + c, r + done, g + done, b + done, length - done, chromaFactor);
+        return;
+    }
+#endif
+    YCbCrToRGBScalar(y + done, cb + c, cr + c, r + done, g + done, b + done, length - done, chromaFactor);
+}
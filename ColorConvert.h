@@ -0,0 +1,38 @@
+#ifndef JPEGINCPLUSPLUS_COLORCONVERT_H
+#define JPEGINCPLUSPLUS_COLORCONVERT_H
+
+#include <cstddef>
+#include "SIMD.h"
+
+// Fixed-point YCbCr to RGB conversion (JFIF, 16 fractional bits, same rounding
+// as libjpeg) from 8-bit sample rows to 8-bit R, G and B rows, clamped to 0..255.
+// Horizontally subsampled chroma is upsampled on the fly by repeating each
+// chroma sample, so full-width Cb/Cr rows are never built. All kernels produce
+// bit-identical output.
+
+// kernel used by YCbCrToRGBRow, defaults to bestSIMDLevel()
+// returns false if the level is not supported here
+bool setColorKernel(SIMDLevel level);
+SIMDLevel getColorKernel();
+
+// convert length pixels; cb and cr hold one sample per chromaFactor (1 or 2) pixels
+// length must be a multiple of 8
+void YCbCrToRGBRow(const unsigned char* y, const unsigned char* cb, const unsigned char* cr,
+                   unsigned char* r, unsigned char* g, unsigned char* b, std::size_t length, unsigned int chromaFactor);
+
+void YCbCrToRGBScalar(const unsigned char* y, const unsigned char* cb, const unsigned char* cr,
+                      unsigned char* r, unsigned char* g, unsigned char* b, std::size_t length, unsigned int chromaFactor);
+
+#if defined(__SSE2__)
+// length must be a multiple of 8
+void YCbCrToRGBSSE2(const unsigned char* y, const unsigned char* cb, const unsigned char* cr,
+                    unsigned char* r, unsigned char* g, unsigned char* b, std::size_t length, unsigned int chromaFactor);
+#endif
+
+#ifdef JPEG_HAVE_AVX2
+// length must be a multiple of 16
+void YCbCrToRGBAVX2(const unsigned char* y, const unsigned char* cb, const unsigned char* cr,
+                    unsigned char* r, unsigned char* g, unsigned char* b, std::size_t length, unsigned int chromaFactor);
+#endif
+
+#endif //JPEGINCPLUSPLUS_COLORCONVERT_H
@@ -0,0 +1,76 @@
+// built with -mavx2 and only called after a runtime CPU check, see ColorConvert.cpp
+
+#include "ColorConvert.h"
+#include "ColorConvertConstants.h"
+
+#include <immintrin.h>
+
+// same arithmetic as ColorConvert.cpp, sixteen pixels at a time
+
+static inline __m256i pairConstant(const int a, const int b) {
+    return _mm256_set1_epi32((int) (((unsigned int) b << 16) | ((unsigned int) a & 0xFFFF)));
+}
+
+// sixteen chroma samples widened to 16 bits, each repeated if chroma is subsampled
+template <unsigned int chromaFactor>
+static inline __m256i loadChromaAVX2(const unsigned char* const chroma) {
+    if (chromaFactor == 2) {
+        const __m128i eight = _mm_loadl_epi64((const __m128i*) chroma);
+        return _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(eight, eight));
+    }
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) chroma));
+}
+
+// one instance per chroma factor, as in ColorConvert.cpp
+template <unsigned int chromaFactor>
+static void YCbCrToRGBAVX2Fixed(const unsigned char* const y, const unsigned char* const cb, const unsigned char* const cr,
+                                unsigned char* const r, unsigned char* const g, unsigned char* const b, const std::size_t length) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i center = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi32(half);
+
+    const __m256i toR = pairConstant(0, crToR - 65536);
+    const __m256i toG = pairConstant(cbToG, crToG + 65536);
+    const __m256i toB = pairConstant(cbToB - 131072, 0);
+
+    for (std::size_t i = 0; i < length; i += 16) {
+        const std::size_t c = chromaFactor == 2 ? i / 2 : i;
+        const __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (y + i)));
+        const __m256i blue = _mm256_sub_epi16(loadChromaAVX2<chromaFactor>(cb + c), center);
+        const __m256i red = _mm256_sub_epi16(loadChromaAVX2<chromaFactor>(cr + c), center);
+
+        // unpacks work within 128-bit lanes: the low half holds pixels 0-3 and 8-11, the high half 4-7 and 12-15
+        __m256i channels[3][2];
+        for (unsigned int part = 0; part < 2; ++part) {
+            const __m256i pairs = part ? _mm256_unpackhi_epi16(blue, red) : _mm256_unpacklo_epi16(blue, red);
+            const __m256i redShifted = part ? _mm256_unpackhi_epi16(zero, red) : _mm256_unpacklo_epi16(zero, red);
+            const __m256i blueShifted = _mm256_slli_epi32(part ? _mm256_unpackhi_epi16(zero, blue) : _mm256_unpacklo_epi16(zero, blue), 1);
+            const __m256i luma32 = part ? _mm256_unpackhi_epi16(luma, zero) : _mm256_unpacklo_epi16(luma, zero);
+
+            const __m256i toRed = _mm256_add_epi32(_mm256_madd_epi16(pairs, toR), redShifted);
+            const __m256i toGreen = _mm256_sub_epi32(_mm256_madd_epi16(pairs, toG), redShifted);
+            const __m256i toBlue = _mm256_add_epi32(_mm256_madd_epi16(pairs, toB), blueShifted);
+
+            channels[0][part] = _mm256_add_epi32(luma32, _mm256_srai_epi32(_mm256_add_epi32(toRed, round), 16));
+            channels[1][part] = _mm256_add_epi32(luma32, _mm256_srai_epi32(_mm256_add_epi32(toGreen, round), 16));
+            channels[2][part] = _mm256_add_epi32(luma32, _mm256_srai_epi32(_mm256_add_epi32(toBlue, round), 16));
+        }
+
+        // packs restores pixel order within each lane; packing to unsigned bytes clamps to 0..255
+        unsigned char* const out[3] = {r + i, g + i, b + i};
+        for (unsigned int k = 0; k < 3; ++k) {
+            const __m256i words = _mm256_packs_epi32(channels[k][0], channels[k][1]);
+            const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i*) out[k], _mm256_castsi256_si128(bytes));
+        }
+    }
+}
+
+void YCbCrToRGBAVX2(const unsigned char* const y, const unsigned char* const cb, const unsigned char* const cr,
+                    unsigned char* const r, unsigned char* const g, unsigned char* const b,
+                    const std::size_t length, const unsigned int chromaFactor) {
+    if (chromaFactor == 2)
+        YCbCrToRGBAVX2Fixed<2>(y, cb, cr, r, g, b, length);
+    else
+        YCbCrToRGBAVX2Fixed<1>(y, cb, cr, r, g, b, length);
+}
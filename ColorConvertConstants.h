@@ -0,0 +1,18 @@
+#ifndef JPEGINCPLUSPLUS_COLORCONVERTCONSTANTS_H
+#define JPEGINCPLUSPLUS_COLORCONVERTCONSTANTS_H
+
+// JFIF YCbCr to RGB factors with 16 fractional bits, rounded at compile time as libjpeg rounds them
+
+constexpr int colorBits = 16;
+
+constexpr int colorFix(const double x) {
+    return (int) (x * (1 << colorBits) + 0.5);
+}
+
+constexpr int crToR = colorFix(1.40200);
+constexpr int cbToG = -colorFix(0.34414);
+constexpr int crToG = -colorFix(0.71414);
+constexpr int cbToB = colorFix(1.77200);
+constexpr int half = 1 << (colorBits - 1);
+
+#endif //JPEGINCPLUSPLUS_COLORCONVERTCONSTANTS_H
@@ -1,51 +1,83 @@
-#include "JPEG.h"
+#include "Decoder.h"
+#include "IDCT.h"
+#include "ColorConvert.h"
 #include <iostream>
-#include <fstream>
+#include <new>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <unistd.h>
+
+const char* errorString(const JPEGError error) {
+    switch (error) {
+        case JPEGError::None: return "No error";
+        case JPEGError::FileError: return "Error opening or reading file";
+        case JPEGError::OutOfMemory: return "Memory error";
+        case JPEGError::NotJPEG: return "Not a JPEG file";
+        case JPEGError::Truncated: return "File ended prematurely";
+        case JPEGError::InvalidMarker: return "Invalid marker";
+        case JPEGError::InvalidTable: return "Invalid table";
+        case JPEGError::InvalidFrame: return "Invalid frame or scan header";
+        case JPEGError::Unsupported: return "Unsupported JPEG";
+        case JPEGError::InvalidData: return "Invalid compressed data";
+        case JPEGError::WriteError: return "Error writing output file";
+        case JPEGError::InvalidArgument: return "Invalid output buffer or parameters";
+    }
+    return "Unknown error";
+}
+
+// mark the header unusable, keeping the first reason given
+void setError(Header* const header, const JPEGError error) {
+    if (header->valid)
+        header->error = error;
+    header->valid = false;
+}
 
-void readAPPN(std::ifstream& inFile, Header* const header) {
-    std::cout << "Reading APPN marker\n";
+void readAPPN(ByteSource& inFile, Header* const header) {
+    JPEG_LOG_DEBUG("Reading APPN marker");
     unsigned int length = (inFile.get() << 8) + inFile.get();
 
-    for (unsigned int i = 0; i < length - 2; ++i)
-        inFile.get();
+    inFile.skip(length - 2);
 
 }
 
-void readStartOfFrame(std::ifstream& inFile, Header* const header) {
-    std::cout << "Reading SOF marker\n";
+void readStartOfFrame(ByteSource& inFile, Header* const header) {
+    JPEG_LOG_DEBUG("Reading SOF marker");
     if (header->numComponents != 0) {
-        std::cout << "Error - Multiple SOFs detected\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("Multiple SOFs detected");
+        setError(header, JPEGError::InvalidMarker);
         return;
     }
 
-    unsigned int length = (inFile.get() < 8) + inFile.get();
+    unsigned int length = (inFile.get() << 8) + inFile.get();
 
     unsigned char precision = inFile.get();
     if (precision != 8) {
-        std::cout << "Error - Invalid precision: " << (unsigned int) precision << std::endl;
-        header->valid = false;
+        JPEG_LOG_ERROR("Invalid precision: " << (unsigned int) precision);
+        setError(header, JPEGError::Unsupported);
         return;
     }
 
-    header->height = (inFile.get() < 8) + inFile.get();
-    header->width = (inFile.get() < 8) + inFile.get();
+    header->height = (inFile.get() << 8) + inFile.get();
+    header->width = (inFile.get() << 8) + inFile.get();
     if (header->width == 0 || header->height == 0) {
-        std::cout << "Error - Invalid dimensions\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("Invalid dimensions");
+        setError(header, JPEGError::InvalidFrame);
         return;
     }
 
     header->numComponents = inFile.get();
     if (header->numComponents == 4) {
-        std::cout << "Error - CMYK color mode not supported\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("CMYK color mode not supported");
+        setError(header, JPEGError::Unsupported);
         return;
     }
 
     if (header->numComponents == 0) {
-        std::cout << "Error - Number of color components must not be zero\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("Number of color components must not be zero");
+        setError(header, JPEGError::InvalidFrame);
         return;
     }
 
@@ -63,19 +95,19 @@ void readStartOfFrame(std::ifstream& inFile, Header* const header) {
         }
 
         if (componentID == 4 || componentID == 5) {
-            std::cout << "Error - YIQ color mode not supported\n";
-            header->valid = false;
+            JPEG_LOG_ERROR("YIQ color mode not supported");
+            setError(header, JPEGError::Unsupported);
             return;
         }
         if (componentID == 0 || componentID > 5) {
-            std::cout << "Error - Invalid component ID: " << (unsigned int) componentID << std::endl;
-            header->valid = false;
+            JPEG_LOG_ERROR("Invalid component ID: " << (unsigned int) componentID);
+            setError(header, JPEGError::InvalidFrame);
             return;
         }
         ColorComponent *component = &header->colorComponents[componentID - 1];
         if (component->used) {
-            std::cout << "Error - Duplicate color component ID\n";
-            header->valid = false;
+            JPEG_LOG_ERROR("Duplicate color component ID");
+            setError(header, JPEGError::InvalidFrame);
             return;
         }
         component->used = true;
@@ -83,27 +115,28 @@ void readStartOfFrame(std::ifstream& inFile, Header* const header) {
         component->horizontalSamplingFactor = samplingFactor >> 4;
         component->verticalSamplingFactor = samplingFactor & 0x0F;
 
-        if (component->horizontalSamplingFactor != 1 || component->verticalSamplingFactor != 1) {
-            std::cout << "Error - Sampling factors not yet supported\n";
-            header->valid = false;
+        if (component->horizontalSamplingFactor < 1 || component->horizontalSamplingFactor > 2 ||
+            component->verticalSamplingFactor < 1 || component->verticalSamplingFactor > 2) {
+            JPEG_LOG_ERROR("Sampling factors not supported");
+            setError(header, JPEGError::Unsupported);
             return;
         }
 
         component->quantizationTableID = inFile.get();
         if (component->quantizationTableID > 3) {
-            std::cout << "Error - Invalid quantization table ID in frame components\n";
-            header->valid = false;
+            JPEG_LOG_ERROR("Invalid quantization table ID in frame components");
+            setError(header, JPEGError::InvalidFrame);
             return;
         }
     }
     if (length - 8 - (3 * header->numComponents) != 0) {
-        std::cout << "Error - SOF invalid\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("SOF invalid");
+        setError(header, JPEGError::InvalidMarker);
     }
 }
 
-void readQuantizationTable (std::ifstream& inFile, Header* const header) {
-    std::cout << "Reading DQT marker\n";
+void readQuantizationTable (ByteSource& inFile, Header* const header) {
+    JPEG_LOG_DEBUG("Reading DQT marker");
     int length = (inFile.get() << 8) + (inFile.get());
     length -= 2;
 
@@ -113,42 +146,71 @@ void readQuantizationTable (std::ifstream& inFile, Header* const header) {
         unsigned char tableID = tableInfo & 0x0F;
 
         if (tableID > 3) {
-            std::cout << "Error - Invalid quantization table ID: " << (unsigned int) tableID << std::endl;
-            header->valid = false;
+            JPEG_LOG_ERROR("Invalid quantization table ID: " << (unsigned int) tableID);
+            setError(header, JPEGError::InvalidTable);
             return;
         }
-        header->quantizationTables[tableID].set = true;
+        QuantizationTable& table = header->quantizationTables[tableID];
+        table.set = true;
 
         if (tableInfo >> 4 != 0) {
             for (unsigned int i = 0; i < 64; ++i)
-                header->quantizationTables[tableID].table[zigZagMap[i]] = (inFile.get() << 8) + inFile.get();
+                table.table[zigZagMap[i]] = (inFile.get() << 8) + inFile.get();
             length -= 128;
         }
         else {
             for (unsigned int i = 0; i < 64; ++i)
-                header->quantizationTables[tableID].table[zigZagMap[i]] = inFile.get();
+                table.table[zigZagMap[i]] = inFile.get();
             length -= 64;
         }
+        for (unsigned int i = 0; i < 64; ++i)
+            table.multipliers[i] = (short) std::min(table.table[i], 32767u);
     }
     if (length != 0) {
-        std::cout << "Error - DQT marker invalid\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("DQT marker invalid");
+        setError(header, JPEGError::InvalidMarker);
     }
 }
 
-void readRestartInterval(std::ifstream& inFile, Header* const header) {
-    std::cout << "Reading DRI marker\n";
+void readRestartInterval(ByteSource& inFile, Header* const header) {
+    JPEG_LOG_DEBUG("Reading DRI marker");
     unsigned int length = (inFile.get() << 8) + inFile.get();
 
     header->restartInternal = (inFile.get() << 8) + inFile.get();
     if (length - 4 != 0) {
-        std::cout << "Error - DRI invalid\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("DRI invalid");
+        setError(header, JPEGError::InvalidMarker);
+    }
+}
+
+// build the lookahead table and the long-code limits of a Huffman table from its code length counts
+bool generateHuffmanLookup(HuffmanTable* const hTable) {
+    for (unsigned int i = 0; i < (1u << huffmanLookupBits); ++i)
+        hTable->lookup[i] = 0;
+
+    unsigned int code = 0;
+    for (unsigned int length = 1; length <= 16; ++length) {
+        hTable->valueOffset[length] = (int) hTable->offsets[length - 1] - (int) code;
+        for (unsigned int i = hTable->offsets[length - 1]; i < hTable->offsets[length]; ++i) {
+            if (code >= (1u << length))
+                return false;
+
+            // every lookahead whose leading bits equal this code resolves to it
+            if (length <= huffmanLookupBits) {
+                const unsigned int shift = huffmanLookupBits - length;
+                for (unsigned int j = 0; j < (1u << shift); ++j)
+                    hTable->lookup[(code << shift) + j] = (length << 8) | hTable->symbols[i];
+            }
+            code += 1;
+        }
+        hTable->maxCode[length] = (hTable->offsets[length] > hTable->offsets[length - 1]) ? (int) code - 1 : -1;
+        code <<= 1;
     }
+    return true;
 }
 
-void readHuffmanTable(std::ifstream& inFile, Header* const header) {
-    std::cout << "Reading DHT marker\n";
+void readHuffmanTable(ByteSource& inFile, Header* const header) {
+    JPEG_LOG_DEBUG("Reading DHT marker");
     int length = (inFile.get() << 8) + inFile.get();
     length -= 2;
 
@@ -158,8 +220,8 @@ void readHuffmanTable(std::ifstream& inFile, Header* const header) {
         bool ACTable = tableInfo >> 4;
 
         if (tableID > 3) {
-            std::cout << "Error - Invalid Huffman table ID: " << (unsigned int) tableID << '\n';
-            header->valid = false;
+            JPEG_LOG_ERROR("Invalid Huffman table ID: " << (unsigned int) tableID);
+            setError(header, JPEGError::InvalidTable);
             return;
         }
 
@@ -180,8 +242,8 @@ void readHuffmanTable(std::ifstream& inFile, Header* const header) {
         }
 
         if (allSymbols > 162) {
-            std::cout << "Error - Too many symbols in Huffman table\n";
-            header->valid = false;
+            JPEG_LOG_ERROR("Too many symbols in Huffman table");
+            setError(header, JPEGError::InvalidTable);
             return;
         }
 
@@ -189,21 +251,62 @@ void readHuffmanTable(std::ifstream& inFile, Header* const header) {
             hTable->symbols[i] = inFile.get();
         }
 
+        if (!generateHuffmanLookup(hTable)) {
+            JPEG_LOG_ERROR("Invalid Huffman code lengths");
+            setError(header, JPEGError::InvalidTable);
+            return;
+        }
+
         length -= 17 + allSymbols;
     }
 
     if (length != 0) {
-        std::cout << "Error - DHT invalid\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("DHT invalid");
+        setError(header, JPEGError::InvalidMarker);
+    }
+}
+
+// record a progressive scan just read, with a copy of the Huffman tables it uses, since
+// the tables may be redefined before the next one
+void addProgressiveScan(Header* const header, const unsigned int numComponents, const unsigned char* const components) {
+    header->scans.emplace_back();
+    ScanHeader& scan = header->scans.back();
+    scan.numComponents = numComponents;
+    scan.startOfSelection = header->startofSelection;
+    scan.endOfSelection = header->endOfSelection;
+    scan.successiveApproximationHigh = header->successiveApproximationHigh;
+    scan.successiveApproximationLow = header->successiveApproximationLow;
+    scan.restartInterval = header->restartInternal;
+
+    for (unsigned int i = 0; i < numComponents; ++i) {
+        const ColorComponent& component = header->colorComponents[components[i]];
+        scan.components[i] = components[i];
+        // DC refinement bits are not Huffman coded
+        if (scan.startOfSelection == 0 && scan.successiveApproximationHigh == 0) {
+            if (!header->huffmanDCTables[component.huffmanDCTableID].set) {
+                JPEG_LOG_ERROR("Color component using uninitialized Huffman DC table");
+                setError(header, JPEGError::InvalidTable);
+                return;
+            }
+            scan.huffmanTables[i] = header->huffmanDCTables[component.huffmanDCTableID];
+        }
+        else if (scan.startOfSelection != 0) {
+            if (!header->huffmanACTables[component.huffmanACTableID].set) {
+                JPEG_LOG_ERROR("Color component using uninitialized Huffman AC table");
+                setError(header, JPEGError::InvalidTable);
+                return;
+            }
+            scan.huffmanTables[i] = header->huffmanACTables[component.huffmanACTableID];
+        }
     }
 }
 
-void readStartOfScan(std::ifstream& inFile, Header* const header) {
+void readStartOfScan(ByteSource& inFile, Header* const header) {
 
-    std::cout << "Reading SOS Marker\n";
+    JPEG_LOG_DEBUG("Reading SOS Marker");
     if (header->numComponents == 0) {
-        std::cout << "Error - SOS detected before SOF\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("SOS detected before SOF");
+        setError(header, JPEGError::InvalidMarker);
         return;
     }
 
@@ -214,38 +317,45 @@ void readStartOfScan(std::ifstream& inFile, Header* const header) {
     }
 
     unsigned char numComponents = inFile.get();
+    if (numComponents == 0 || numComponents > header->numComponents) {
+        JPEG_LOG_ERROR("Invalid number of scan components: " << (unsigned int) numComponents);
+        setError(header, JPEGError::InvalidFrame);
+        return;
+    }
+    unsigned char scanComponents[3] = {0};
     for (unsigned int i = 0; i < numComponents; ++i) {
         unsigned char componentID = inFile.get();
         // component IDs are usually 1, 2, 3 but can rarely be 0, 1, 2
         if (header->zeroBased) {
             componentID += 1;
         }
-        if (componentID > header->numComponents) {
-            std::cout << "Error - Invalid color component ID: " << (unsigned int) componentID << '\n';
-            header->valid = false;
+        if (componentID == 0 || componentID > header->numComponents) {
+            JPEG_LOG_ERROR("Invalid color component ID: " << (unsigned int) componentID);
+            setError(header, JPEGError::InvalidFrame);
             return;
         }
         ColorComponent *component = &header->colorComponents[componentID - 1];
         if (component->used) {
-            std::cout << "Error - Duplicate color component ID: " << (unsigned int) componentID << '\n';
-            header->valid = false;
+            JPEG_LOG_ERROR("Duplicate color component ID: " << (unsigned int) componentID);
+            setError(header, JPEGError::InvalidFrame);
             return;
         }
 
         component->used = true;
+        scanComponents[i] = componentID - 1;
 
         unsigned char huffmanTableIDs = inFile.get();
         component->huffmanDCTableID = huffmanTableIDs >> 4;
         component->huffmanACTableID = huffmanTableIDs & 0x0F;
 
         if (component->huffmanDCTableID > 3) {
-            std::cout << "Error - Invalid Huffman DC table ID: " << (unsigned int) component->huffmanDCTableID << '\n';
-            header->valid = false;
+            JPEG_LOG_ERROR("Invalid Huffman DC table ID: " << (unsigned int) component->huffmanDCTableID);
+            setError(header, JPEGError::InvalidTable);
             return;
         }
         if (component->huffmanACTableID > 3) {
-            std::cout << "Error - Invalid Huffman AC table ID: " << (unsigned int) component->huffmanACTableID << '\n';
-            header->valid = false;
+            JPEG_LOG_ERROR("Invalid Huffman AC table ID: " << (unsigned int) component->huffmanACTableID);
+            setError(header, JPEGError::InvalidTable);
             return;
         }
     }
@@ -253,79 +363,75 @@ void readStartOfScan(std::ifstream& inFile, Header* const header) {
     header->startofSelection = inFile.get();
     header->endOfSelection = inFile.get();
     unsigned char successiveApproximation = inFile.get();
-    header->successiveApproximationHigh = successiveApproximation > 4;
+    header->successiveApproximationHigh = successiveApproximation >> 4;
     header->successiveApproximationLow = successiveApproximation & 0x0F;
 
-    // Baseline JPEGs don't use spectral selection or successive approximation
-    if (header->startofSelection != 0 || header->endOfSelection != 63) {
-        std::cout << "Error - Invalid spectral selection | May not be baseline JPEG\n";
-        header->valid = false;
-        return;
+    if (header->frameType == SOF2) {
+        // a DC scan covers coefficient 0 alone, an AC scan a band of one component's AC coefficients
+        if (header->startofSelection == 0 ? header->endOfSelection != 0 :
+            (header->endOfSelection < header->startofSelection || header->endOfSelection > 63 || numComponents != 1)) {
+            JPEG_LOG_ERROR("Invalid spectral selection");
+            setError(header, JPEGError::InvalidFrame);
+            return;
+        }
+        // each refinement scan adds one bit
+        if (header->successiveApproximationLow > 13 ||
+            (header->successiveApproximationHigh != 0 && header->successiveApproximationLow + 1 != header->successiveApproximationHigh)) {
+            JPEG_LOG_ERROR("Invalid successive approximation");
+            setError(header, JPEGError::InvalidFrame);
+            return;
+        }
     }
+    // Baseline JPEGs don't use spectral selection or successive approximation
+    else {
+        if (header->startofSelection != 0 || header->endOfSelection != 63) {
+            JPEG_LOG_ERROR("Invalid spectral selection | May not be baseline JPEG");
+            setError(header, JPEGError::Unsupported);
+            return;
+        }
 
-    if (header->successiveApproximationHigh != 0 || header->successiveApproximationLow != 0) {
-        std::cout << "Error - Invalid successive approximation | May not be baseline JPEG\n";
-        header->valid = false;
-        return;
+        if (header->successiveApproximationHigh != 0 || header->successiveApproximationLow != 0) {
+            JPEG_LOG_ERROR("Invalid successive approximation | May not be baseline JPEG");
+            setError(header, JPEGError::Unsupported);
+            return;
+        }
     }
 
     if (length - 6 - (2 * numComponents) != 0) {
-        std::cout << "Error - SOS invalid\n";
-        header->valid = false;
+        JPEG_LOG_ERROR("SOS invalid");
+        setError(header, JPEGError::InvalidMarker);
+        return;
     }
 
+    if (header->frameType == SOF2)
+        addProgressiveScan(header, numComponents, scanComponents);
 }
 
-void readComment(std::ifstream& inFile, Header* const header) {
+void readComment(ByteSource& inFile, Header* const header) {
 
-    std::cout << "Reading COM Marker\n";
+    JPEG_LOG_DEBUG("Reading COM Marker");
     unsigned int length = (inFile.get() << 8) + inFile.get();
 
-    for (unsigned int i = 0; i < length - 2; ++i) {
-        inFile.get();
-    }
+    inFile.skip(length - 2);
 
 }
 
-Header* readJPG(const std::string& filename) {
-    std::ifstream inFile = std::ifstream(filename, std::ios::in | std::ios::binary);
-    if (!inFile.is_open()) {
-        std::cout << "Error - Error opening file " << filename << std::endl;
-        return nullptr;
-    }
-
-    Header *header = new (std::nothrow) Header;
-
-    if (header == nullptr) {
-        inFile.close();
-        std::cout << "Error - Memory error\n";
-        return nullptr;
-    }
-
+// read the markers up to and including the next SOS, leaving inFile at the start of the scan data
+void readMarkers(ByteSource& inFile, Header* const header) {
     unsigned int last = inFile.get();
     unsigned int current = inFile.get();
 
-    if (last != 0xFF || current != SOI) {
-        header->valid = false;
-        inFile.close();
-        return header;
-    }
-
-    last = inFile.get();
-    current = inFile.get();
-
     while (header->valid) {
         if (!inFile) {
-            std::cout << "File ended prematurely\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("File ended prematurely");
+            setError(header, JPEGError::Truncated);
+            return;
         }
 
         if (last != 0xFF) {
-            std::cout << "Error - Expected a marker\n";
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Expected a marker");
+            setError(header, JPEGError::InvalidMarker);
+            return;
         }
 
         if (current == SOS) {
@@ -341,8 +447,8 @@ Header* readJPG(const std::string& filename) {
             readRestartInterval(inFile, header);
         }
 
-        else if (current == SOF0) {
-            header->frameType = SOF0;
+        else if (current == SOF0 || current == SOF2) {
+            header->frameType = current;
             readStartOfFrame(inFile, header);
         }
 
@@ -369,142 +475,325 @@ Header* readJPG(const std::string& filename) {
         }
 
         else if (current == SOI) {
-            std::cout << "Error - Embedded JPGs not supported\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Embedded JPGs not supported");
+            setError(header, JPEGError::Unsupported);
+            return;
         }
 
         else if (current == EOI) {
-            std::cout << "Error - EOI detected before SOS\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("EOI detected before SOS");
+            setError(header, JPEGError::InvalidMarker);
+            return;
         }
 
         else if (current == DAC) {
-            std::cout << "Error - Arithmetic coding mode not supported\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Arithmetic coding mode not supported");
+            setError(header, JPEGError::Unsupported);
+            return;
         }
 
         else if (current >= SOF0 && current <= SOF15) {
-            std::cout << "Error - SOF marker not supported: 0x\n" << std::hex << (unsigned int) current << std::dec << '\n';
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("SOF marker not supported: 0x" << std::hex << (unsigned int) current);
+            setError(header, JPEGError::Unsupported);
+            return;
         }
 
         else if (current >= RST0 && current <= RST7) {
-            std::cout << "Error - RSTN detected before SOS\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("RSTN detected before SOS");
+            setError(header, JPEGError::InvalidMarker);
+            return;
         }
 
         else {
-            std::cout << "Error - Unknown marker: 0x" << std::hex << (unsigned int) current << std::dec << '\n';
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Unknown marker: 0x" << std::hex << (unsigned int) current);
+            setError(header, JPEGError::InvalidMarker);
+            return;
         }
 
         last = inFile.get();
         current = inFile.get();
     }
+}
 
-    // after SOS
-
-    if (header->valid) {
+// read the markers up to and including the first SOS
+void readFrameHeader(ByteSource& inFile, Header* const header) {
+    const int first = inFile.get();
+    const int second = inFile.get();
 
-        current = inFile.get();
+    if (first != 0xFF || second != SOI) {
+        JPEG_LOG_ERROR("Missing SOI marker");
+        setError(header, JPEGError::NotJPEG);
+        return;
+    }
 
-        //Read compressed image data
+    readMarkers(inFile, header);
+}
 
-        while (true) {
-            if (!inFile) {
-                std::cout << "Error - File ended premature\n";
-                header->valid = false;
-                inFile.close();
-                return header;
-            }
+// move inFile past the compressed data of a scan, which is left in place, onto the marker ending it
+// byte stuffing and restart markers are handled by the bit reader; the offset from the start of
+// the scan of each restart interval after the first is added to restartOffsets, if given
+// returns the marker, or 0 if the data runs to the end of the file
+unsigned char skipScanData(ByteSource& inFile, Header* const header, std::vector<std::size_t>* const restartOffsets) {
+    const unsigned char* const data = inFile.begin();
+    const std::size_t start = inFile.tell();
+    std::size_t position = start;
+
+    while (true) {
+        const void* const marker = std::memchr(data + position, 0xFF, inFile.size() - position);
+        if (marker == nullptr || static_cast<const unsigned char*>(marker) + 1 >= data + inFile.size()) {
+            JPEG_LOG_ERROR("File ended premature");
+            setError(header, JPEGError::Truncated);
+            return 0;
+        }
+        position = static_cast<const unsigned char*>(marker) - data;
+        const unsigned char current = data[position + 1];
 
-            last = current;
-            current = inFile.get();
+        // 0xFF00 is a literal 0xFF in image data
+        if (current == 0x00) {
+            position += 2;
+        }
+        // RSTN separates restart intervals, remember where the next one starts
+        else if (current >= RST0 && current <= RST7) {
+            position += 2;
+            if (restartOffsets != nullptr)
+                restartOffsets->push_back(position - start);
+        }
+        // ignore multiple 0xFF's in a row
+        else if (current == 0xFF) {
+            position += 1;
+        }
+        else {
+            inFile.skip(position - start);
+            return current;
+        }
+    }
+}
 
-            // if marker is found
-            if (last == 0xFF) {
-                // end of image
+// find the end of the compressed image data, which is left in place
+// a progressive image's scans are indexed one by one along with the markers between them
+void findScanData(ByteSource& inFile, Header* const header) {
+    const bool progressive = header->frameType == SOF2;
+    const std::size_t start = inFile.tell();
 
-                if (current == EOI) {
-                    break;
-                }
+    while (true) {
+        const std::size_t scanStart = inFile.tell();
+        const unsigned char marker = skipScanData(inFile, header, progressive ? nullptr : &header->restartOffsets);
+        if (!header->valid)
+            return;
 
-                //0xFF00 means put a literal 0xFF in image data and ignore 0x00
-                else if (current == 0x00) {
-                    header->huffmanData.push_back(last);
-                    // overwrite 0x00 with next byte
-                    current = inFile.get();
-                }
-                // restart marker
-                else if (current >= RST0 && current <= RST7) {
-                    // overwrite marker with next byte
-                    current = inFile.get();
-                }
-                // ignore multiple 0xFF's in a row
-                else if (current == 0xFF) {
-                    continue;
-                }
+        if (progressive) {
+            header->scans.back().data = inFile.begin() + scanStart;
+            header->scans.back().length = inFile.tell() - scanStart;
+        }
 
-                else {
-                    std::cout << "Error - Invalid marker during compressed data scan: 0x" << std::hex << (unsigned int) current << std::dec << '\n';
-                    header->valid = false;
-                    inFile.close();
-                    return header;
-                }
-            }
+        // end of image
+        if (marker == EOI)
+            break;
 
-            else {
-                header->huffmanData.push_back(last);
-            }
+        if (!progressive) {
+            JPEG_LOG_ERROR("Invalid marker during compressed data scan: 0x" << std::hex << (unsigned int) marker);
+            setError(header, JPEGError::InvalidMarker);
+            return;
         }
+
+        // tables and restart intervals may change before the next scan
+        readMarkers(inFile, header);
+        if (!header->valid)
+            return;
     }
 
-    // validate header info
+    header->huffmanData = inFile.begin() + start;
+    header->huffmanDataLength = inFile.tell() - start;
+    inFile.skip(2);
+}
 
+// check the frame and scan headers describe an image the decoder can handle, and size it in MCUs
+void validateHeader(Header* const header) {
     if (header->numComponents != 1 && header->numComponents != 3) {
-        std::cout << "Error - " << (unsigned int) header->numComponents << " color components given (1 or 3 required)\n";
-        header->valid = false;
-        inFile.close();
-        return header;
+        JPEG_LOG_ERROR((unsigned int) header->numComponents << " color components given (1 or 3 required)");
+        setError(header, JPEGError::Unsupported);
+        return;
     }
 
     for (unsigned int i = 0; i < header->numComponents; ++i) {
         if (!header->quantizationTables[header->colorComponents[i].quantizationTableID].set) {
-            std::cout << "Error - Color component using uninitialized quantization table\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Color component using uninitialized quantization table");
+            setError(header, JPEGError::InvalidTable);
+            return;
         }
+        // the Huffman tables of progressive scans are checked scan by scan
+        if (header->frameType == SOF2)
+            continue;
         if (!header->huffmanDCTables[header->colorComponents[i].huffmanDCTableID].set) {
-            std::cout << "Error - Color component using uninitialized Huffman DC table\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Color component using uninitialized Huffman DC table");
+            setError(header, JPEGError::InvalidTable);
+            return;
         }
         if (!header->huffmanACTables[header->colorComponents[i].huffmanACTableID].set) {
-            std::cout << "Error - Color component using uninitialized Huffman AC table\n";
-            header->valid = false;
-            inFile.close();
-            return header;
+            JPEG_LOG_ERROR("Color component using uninitialized Huffman AC table");
+            setError(header, JPEGError::InvalidTable);
+            return;
+        }
+    }
+
+    // a single component is coded one block at a time whatever its sampling factors say
+    if (header->numComponents == 1) {
+        header->colorComponents[0].horizontalSamplingFactor = 1;
+        header->colorComponents[0].verticalSamplingFactor = 1;
+    }
+
+    // luminance sets the MCU size, both chroma components share one size that divides it
+    const ColorComponent& luminance = header->colorComponents[0];
+    for (unsigned int i = 1; i < header->numComponents; ++i) {
+        const ColorComponent& chrominance = header->colorComponents[i];
+        if (luminance.horizontalSamplingFactor % chrominance.horizontalSamplingFactor != 0 ||
+            luminance.verticalSamplingFactor % chrominance.verticalSamplingFactor != 0 ||
+            chrominance.horizontalSamplingFactor != header->colorComponents[1].horizontalSamplingFactor ||
+            chrominance.verticalSamplingFactor != header->colorComponents[1].verticalSamplingFactor) {
+            JPEG_LOG_ERROR("Sampling factors not supported");
+            setError(header, JPEGError::Unsupported);
+            return;
         }
     }
 
-    inFile.close();
+    header->horizontalSamplingFactor = luminance.horizontalSamplingFactor;
+    header->verticalSamplingFactor = luminance.verticalSamplingFactor;
+    header->mcuWidth = (header->width + 8 * header->horizontalSamplingFactor - 1) / (8 * header->horizontalSamplingFactor);
+    header->mcuHeight = (header->height + 8 * header->verticalSamplingFactor - 1) / (8 * header->verticalSamplingFactor);
+
+    header->layout = SamplingLayout::Other;
+    if (header->numComponents == 1)
+        header->layout = SamplingLayout::Gray;
+    else if (header->colorComponents[1].horizontalSamplingFactor == 1 && header->colorComponents[1].verticalSamplingFactor == 1) {
+        if (header->horizontalSamplingFactor == 1 && header->verticalSamplingFactor == 1)
+            header->layout = SamplingLayout::YCbCr444;
+        else if (header->horizontalSamplingFactor == 2 && header->verticalSamplingFactor == 1)
+            header->layout = SamplingLayout::YCbCr422;
+        else if (header->horizontalSamplingFactor == 2 && header->verticalSamplingFactor == 2)
+            header->layout = SamplingLayout::YCbCr420;
+    }
+    header->outputWidth = header->width;
+    header->outputHeight = header->height;
+}
+
+bool readJPG(const std::string& filename, Header* const header) {
+    DecodeStats* const stats = &header->stats;
+
+    // the header keeps the input open so the entropy-coded data can be decoded in place
+    ByteSource& inFile = header->source;
+    bool opened;
+    {
+        JPEG_STATS_TIMER(stats, fileRead);
+        opened = inFile.open(filename);
+    }
+    if (!opened) {
+        JPEG_LOG_ERROR("Error opening file " << filename);
+        setError(header, JPEGError::FileError);
+        return false;
+    }
+    JPEG_STATS_ADD(stats, bytesIn, inFile.size());
+
+    {
+        JPEG_STATS_TIMER(stats, markerParse);
+        readFrameHeader(inFile, header);
+        if (header->valid)
+            findScanData(inFile, header);
+        if (header->valid)
+            validateHeader(header);
+    }
+    if (!header->valid)
+        inFile.close();
+    return header->valid;
+}
+
+Header* readJPG(const std::string& filename) {
+    Header *header = new (std::nothrow) Header;
+
+    if (header == nullptr) {
+        JPEG_LOG_ERROR("Memory error");
+        return nullptr;
+    }
+    JPEG_STATS_ADD(&header->stats, allocations, 1);
+
+    readJPG(filename, header);
     return header;
 }
 
+void resetHeader(Header* const header) {
+    // everything but the restart offsets, scans and the input's read buffer is fixed size, so starting over is simplest
+    std::vector<std::size_t> restartOffsets = std::move(header->restartOffsets);
+    std::vector<ScanHeader> scans = std::move(header->scans);
+    ByteSource source = std::move(header->source);
+    source.close();
+    *header = Header();
+    restartOffsets.clear();
+    scans.clear();
+    header->restartOffsets = std::move(restartOffsets);
+    header->scans = std::move(scans);
+    header->source = std::move(source);
+}
+
+JPEGInfo probeJPG(const std::string& filename) {
+    JPEGInfo info;
+    Header *header = new (std::nothrow) Header;
+
+    if (header == nullptr) {
+        JPEG_LOG_ERROR("Memory error");
+        info.valid = false;
+        info.error = JPEGError::OutOfMemory;
+        return info;
+    }
+
+    ByteSource& inFile = header->source;
+    if (!inFile.open(filename)) {
+        JPEG_LOG_ERROR("Error opening file " << filename);
+        setError(header, JPEGError::FileError);
+    }
+
+    // everything needed is known once the scan header has been read
+    if (header->valid)
+        readFrameHeader(inFile, header);
+    // the components as the SOF codes them, before validateHeader normalizes a single one to 1x1
+    for (unsigned int i = 0; i < 3; ++i)
+        info.colorComponents[i] = header->colorComponents[i];
+    if (header->valid)
+        validateHeader(header);
+
+    info.frameType = header->frameType;
+    info.height = header->height;
+    info.width = header->width;
+    info.numComponents = header->numComponents;
+    info.restartInterval = header->restartInternal;
+    info.valid = header->valid;
+    info.error = header->error;
+
+    delete header;
+    return info;
+}
+
+bool setScale(Header* const header, const unsigned int scale) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        return false;
+    header->scale = scale;
+    header->cropX = 0;
+    header->cropY = 0;
+    header->outputWidth = (header->width + scale - 1) / scale;
+    header->outputHeight = (header->height + scale - 1) / scale;
+    return true;
+}
+
+bool setCrop(Header* const header, const unsigned int x, const unsigned int y, const unsigned int width, const unsigned int height) {
+    const unsigned int scaledWidth = (header->width + header->scale - 1) / header->scale;
+    const unsigned int scaledHeight = (header->height + header->scale - 1) / header->scale;
+    if (width == 0 || height == 0 || x >= scaledWidth || y >= scaledHeight || width > scaledWidth - x || height > scaledHeight - y)
+        return false;
+    header->cropX = x;
+    header->cropY = y;
+    header->outputWidth = width;
+    header->outputHeight = height;
+    return true;
+}
+
 void printHeader(const Header* const header) {
     if (header == nullptr)
         return;
@@ -576,13 +865,684 @@ void printHeader(const Header* const header) {
         std::cout << "Huffman DC Table ID: " << (unsigned int) header->colorComponents[i].huffmanDCTableID << '\n';
         std::cout << "Huffman AC Table ID: " << (unsigned int) header->colorComponents[i].huffmanACTableID << '\n';
     }
-    std::cout << "Length of Huffman Data: " << header->restartInternal << '\n';
+    std::cout << "Length of Huffman Data: " << header->huffmanDataLength << '\n';
+    if (header->frameType == SOF2)
+        std::cout << "Number of Scans: " << std::dec << header->scans.size() << '\n';
     std::cout << "DRI===================\n";
     std::cout << "Restart Interval: " << header->restartInternal << '\n';
 }
 
-MCU* blackBox(const Header* const header) {
+// return the next Huffman symbol, or -1 if the bits match no code in the table
+int getNextSymbol(BitReader& b, const HuffmanTable& hTable) {
+    // codes up to huffmanLookupBits long resolve with one lookup
+    const unsigned int entry = hTable.lookup[b.peekBits(huffmanLookupBits)];
+    if (entry != 0) {
+        b.skipBits(entry >> 8);
+        return entry & 0xFF;
+    }
+
+    const unsigned int bits = b.peekBits(16);
+    for (unsigned int length = huffmanLookupBits + 1; length <= 16; ++length) {
+        const int code = bits >> (16 - length);
+        if (code <= hTable.maxCode[length]) {
+            b.skipBits(length);
+            return hTable.symbols[code + hTable.valueOffset[length]];
+        }
+    }
+    return -1;
+}
+
+// turn a length-bit magnitude category value into a signed coefficient
+int extendCoefficient(const unsigned int bits, const unsigned int length) {
+    if (length != 0 && bits < (1u << (length - 1)))
+        return (int) bits - (1 << length) + 1;
+    return (int) bits;
+}
+
+// decode one 8x8 block's coefficients into natural order
+// reduced: only the coefficients set in keep, bit k for zig-zag position k, are extended and stored and
+// the bits of the others are just skipped; keeping the DC alone stores nothing else, not even zeros
+template <bool reduced = false>
+bool decodeMCUComponent(BitReader& b, short* const component, int& previousDC, const HuffmanTable& dcTable, const HuffmanTable& acTable,
+                        const std::uint64_t keep = ~(std::uint64_t) 0) {
+    // DC coefficient is coded as the difference from the previous block's DC
+    const int length = getNextSymbol(b, dcTable);
+    if (length == -1) {
+        JPEG_LOG_ERROR("Invalid DC value");
+        return false;
+    }
+    if (length > 11) {
+        JPEG_LOG_ERROR("DC coefficient length greater than 11");
+        return false;
+    }
+
+    previousDC += extendCoefficient(b.readBits(length), length);
+    component[0] = (short) previousDC;
+
+    const bool storeZeros = !reduced || keep != 1;
+
+    // AC coefficients are coded as (run of zeros, length) pairs
+    unsigned int i = 1;
+    while (i < 64) {
+        const int symbol = getNextSymbol(b, acTable);
+        if (symbol == -1) {
+            JPEG_LOG_ERROR("Invalid AC value");
+            return false;
+        }
+
+        // 0x00 means fill the remainder of the block with zeros
+        if (symbol == 0x00) {
+            if (storeZeros) {
+                for (; i < 64; ++i)
+                    component[zigZagMap[i]] = 0;
+            }
+            return true;
+        }
+
+        // 0xF0 skips 16 zeros, which falls out of the general case as 15 zeros and a zero coefficient
+        const unsigned int numZeros = symbol >> 4;
+        const unsigned int coefficientLength = symbol & 0x0F;
+
+        if (i + numZeros >= 64) {
+            JPEG_LOG_ERROR("Zero run-length exceeded MCU");
+            return false;
+        }
+        if (storeZeros) {
+            for (unsigned int j = 0; j < numZeros; ++j)
+                component[zigZagMap[i + j]] = 0;
+        }
+        i += numZeros;
 
+        if (coefficientLength > 10) {
+            JPEG_LOG_ERROR("AC coefficient length greater than 10");
+            return false;
+        }
+        if (!reduced) {
+            component[zigZagMap[i]] = (short) extendCoefficient(b.readBits(coefficientLength), coefficientLength);
+        }
+        else if (!storeZeros) {
+            b.readBits(coefficientLength);
+        }
+        else {
+            // which coefficients are kept follows no pattern the branch predictor learns, so select where to store
+            short discarded;
+            short* const target = ((keep >> i) & 1) != 0 ? &component[zigZagMap[i]] : &discarded;
+            *target = (short) extendCoefficient(b.readBits(coefficientLength), coefficientLength);
+        }
+        ++i;
+    }
+    return true;
+}
+
+// bit k set if the inverse DCT scaled to size x size samples reads zig-zag coefficient k, as in libjpeg's
+// jidctred: 4x4 leaves out row and column 4, 2x2 reads only rows and columns 0, 1, 3, 5 and 7, 1x1 the DC
+std::uint64_t coefficientMask(const unsigned int size) {
+    std::uint64_t mask = 0;
+    for (unsigned int k = 0; k < 64; ++k) {
+        const unsigned int row = zigZagMap[k] / 8;
+        const unsigned int column = zigZagMap[k] % 8;
+        const bool read = size == 8 ||
+                          (size == 4 && row != 4 && column != 4) ||
+                          (size == 2 && (row < 2 || row % 2 == 1) && (column < 2 || column % 2 == 1)) ||
+                          k == 0;
+        if (read)
+            mask |= (std::uint64_t) 1 << k;
+    }
+    return mask;
+}
+
+// images with fewer MCUs than this are not worth spreading across threads
+const unsigned int minMCUsForParallelDecode = 1024;
+
+// largest band, in MCU rows, used to line bands up with restart intervals
+const unsigned int maxBandRows = 64;
+
+// resize buffer, counting it if that means allocating
+template <typename T>
+void growBuffer(Buffer<T>& buffer, const std::size_t size, unsigned int& allocations) {
+    if (size > buffer.capacity())
+        ++allocations;
+    buffer.resize(size);
+}
+
+Band::Band(Allocator* const allocator) {
+    for (ComponentBand& component : components)
+        component = ComponentBand(allocator);
+    for (Buffer<unsigned char>& plane : pixels)
+        plane = Buffer<unsigned char>(allocator);
+}
+
+bool Band::allocate(const Header* const header, const unsigned int numMCURows) {
+    try {
+        const unsigned int luminanceSize = 8 / header->scale;
+        for (unsigned int j = 0; j < header->numComponents; ++j) {
+            const ColorComponent& colorComponent = header->colorComponents[j];
+            ComponentBand& component = components[j];
+            component.blocksPerLine = header->mcuWidth * colorComponent.horizontalSamplingFactor;
+            component.blockRows = numMCURows * colorComponent.verticalSamplingFactor;
+
+            // subsampled chroma is scaled down less where that does its upsampling, as libjpeg does
+            component.blockSize = luminanceSize;
+            while (component.blockSize < 8 &&
+                   (header->horizontalSamplingFactor * luminanceSize) % (colorComponent.horizontalSamplingFactor * component.blockSize * 2) == 0 &&
+                   (header->verticalSamplingFactor * luminanceSize) % (colorComponent.verticalSamplingFactor * component.blockSize * 2) == 0) {
+                component.blockSize *= 2;
+            }
+            component.coefficientMask = coefficientMask(component.blockSize);
+
+            growBuffer(component.coefficients, (std::size_t) component.blocksPerLine * component.blockRows * 64, allocations);
+            growBuffer(component.samples, component.sampleStride() * component.blockRows * component.blockSize, allocations);
+            if (header->frameType == SOF2) {
+                growBuffer(component.imageCoefficients,
+                           (std::size_t) component.blocksPerLine * header->mcuHeight * colorComponent.verticalSamplingFactor * 64,
+                           allocations);
+            }
+        }
+        if (header->numComponents == 3) {
+            for (Buffer<unsigned char>& plane : pixels)
+                growBuffer(plane, components[0].samples.size(), allocations);
+        }
+        firstMCUColumn = 0;
+        lastMCUColumn = header->mcuWidth;
+    }
+    catch (const std::bad_alloc&) {
+        JPEG_LOG_ERROR("Memory error");
+        return false;
+    }
+    return true;
+}
+
+// each restart interval starts byte aligned with the DC predictions reset
+void startMCU(const Header* const header, ScanState& state, const unsigned int i) {
+    if (header->restartInternal != 0 && i != 0 && i % header->restartInternal == 0 && !state.fresh) {
+        state.previousDCs[0] = 0;
+        state.previousDCs[1] = 0;
+        state.previousDCs[2] = 0;
+        state.reader.restart();
+    }
+    state.fresh = false;
+}
+
+// decodeMCURange for the layouts of SamplingLayout: numComponents components, horizontal x vertical
+// luminance blocks and one block of each chroma component per MCU, tables looked up once
+// reduced: the image is scaled, so only the coefficients the reduced inverse DCT reads are stored
+template <unsigned int numComponents, unsigned int horizontal, unsigned int vertical, bool reduced>
+bool decodeMCURangeFixed(const Header* const header, ScanState& state, const unsigned int first, const unsigned int last, Band& band) {
+    const HuffmanTable* dcTables[numComponents];
+    const HuffmanTable* acTables[numComponents];
+    std::uint64_t masks[numComponents];
+    for (unsigned int j = 0; j < numComponents; ++j) {
+        dcTables[j] = &header->huffmanDCTables[header->colorComponents[j].huffmanDCTableID];
+        acTables[j] = &header->huffmanACTables[header->colorComponents[j].huffmanACTableID];
+        masks[j] = band.components[j].coefficientMask;
+    }
+
+    for (unsigned int i = first; i < last; ++i) {
+        startMCU(header, state, i);
+
+        const std::size_t mcuRow = i / header->mcuWidth - band.firstMCURow;
+        const std::size_t mcuColumn = i % header->mcuWidth;
+
+        ComponentBand& luminance = band.components[0];
+        for (unsigned int v = 0; v < vertical; ++v) {
+            short* const row = &luminance.coefficients[((mcuRow * vertical + v) * luminance.blocksPerLine + mcuColumn * horizontal) * 64];
+            for (unsigned int h = 0; h < horizontal; ++h) {
+                if (!decodeMCUComponent<reduced>(state.reader, row + h * 64, state.previousDCs[0], *dcTables[0], *acTables[0], masks[0]))
+                    return false;
+            }
+        }
+        for (unsigned int j = 1; j < numComponents; ++j) {
+            ComponentBand& chrominance = band.components[j];
+            short* const block = &chrominance.coefficients[(mcuRow * chrominance.blocksPerLine + mcuColumn) * 64];
+            if (!decodeMCUComponent<reduced>(state.reader, block, state.previousDCs[j], *dcTables[j], *acTables[j], masks[j]))
+                return false;
+        }
+    }
+    return true;
+}
+
+// decode MCUs [first, last) of the image into the band holding them
+bool decodeMCURange(const Header* const header, ScanState& state, const unsigned int first, const unsigned int last, Band& band) {
+    const bool reduced = header->scale != 1;
+    switch (header->layout) {
+        case SamplingLayout::Gray:
+            return reduced ? decodeMCURangeFixed<1, 1, 1, true>(header, state, first, last, band)
+                           : decodeMCURangeFixed<1, 1, 1, false>(header, state, first, last, band);
+        case SamplingLayout::YCbCr444:
+            return reduced ? decodeMCURangeFixed<3, 1, 1, true>(header, state, first, last, band)
+                           : decodeMCURangeFixed<3, 1, 1, false>(header, state, first, last, band);
+        case SamplingLayout::YCbCr422:
+            return reduced ? decodeMCURangeFixed<3, 2, 1, true>(header, state, first, last, band)
+                           : decodeMCURangeFixed<3, 2, 1, false>(header, state, first, last, band);
+        case SamplingLayout::YCbCr420:
+            return reduced ? decodeMCURangeFixed<3, 2, 2, true>(header, state, first, last, band)
+                           : decodeMCURangeFixed<3, 2, 2, false>(header, state, first, last, band);
+        default:
+            break;
+    }
+
+    for (unsigned int i = first; i < last; ++i) {
+        startMCU(header, state, i);
+
+        const unsigned int mcuRow = i / header->mcuWidth - band.firstMCURow;
+        const unsigned int mcuColumn = i % header->mcuWidth;
+
+        // each component contributes horizontal x vertical sampling factor blocks, in raster order
+        for (unsigned int j = 0; j < header->numComponents; ++j) {
+            const ColorComponent& component = header->colorComponents[j];
+            ComponentBand& componentBand = band.components[j];
+            for (unsigned int v = 0; v < component.verticalSamplingFactor; ++v) {
+                for (unsigned int h = 0; h < component.horizontalSamplingFactor; ++h) {
+                    const std::size_t blockRow = mcuRow * component.verticalSamplingFactor + v;
+                    const std::size_t blockColumn = mcuColumn * component.horizontalSamplingFactor + h;
+                    short* const block = &componentBand.coefficients[(blockRow * componentBand.blocksPerLine + blockColumn) * 64];
+                    if (!decodeMCUComponent<true>(state.reader, block, state.previousDCs[j],
+                                                  header->huffmanDCTables[component.huffmanDCTableID],
+                                                  header->huffmanACTables[component.huffmanACTableID], componentBand.coefficientMask)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// decode MCUs [first, last) only to move the scan state past them, so nothing but the DC predictions is kept
+bool skipMCURange(const Header* const header, ScanState& state, const unsigned int first, const unsigned int last) {
+    short block[64];
+    for (unsigned int i = first; i < last; ++i) {
+        startMCU(header, state, i);
+        for (unsigned int j = 0; j < header->numComponents; ++j) {
+            const ColorComponent& component = header->colorComponents[j];
+            for (unsigned int k = 0; k < (unsigned int) component.horizontalSamplingFactor * component.verticalSamplingFactor; ++k) {
+                if (!decodeMCUComponent<true>(state.reader, block, state.previousDCs[j], header->huffmanDCTables[component.huffmanDCTableID],
+                                              header->huffmanACTables[component.huffmanACTableID], 1)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool checkOverrun(const ScanState& state) {
+    if (state.reader.overrun()) {
+        JPEG_LOG_ERROR("Huffman data ended prematurely");
+        return false;
+    }
+    return true;
+}
+
+// move state on from MCU position to MCU target, jumping to the start of the restart interval
+// holding target if jump is set and decoding whatever MCUs are left in between
+bool skipToMCU(const Header* const header, ScanState& state, unsigned int& position, const unsigned int target, const bool jump) {
+    if (jump && target / header->restartInternal * header->restartInternal > position) {
+        if (!checkOverrun(state))
+            return false;
+        const unsigned int interval = target / header->restartInternal;
+        const std::size_t offset = header->restartOffsets[interval - 1];
+        state = ScanState(header->huffmanData + offset, header->huffmanDataLength - offset);
+        position = interval * header->restartInternal;
+    }
+    if (!skipMCURange(header, state, position, target))
+        return false;
+    position = target;
+    return true;
+}
+
+// Progressive scans carry either the DC coefficients of one or more components or a band of
+// one component's AC coefficients, each either first time round, shifted left by the scan's
+// successiveApproximationLow, or as one more bit of precision for coefficients already seen.
+
+bool decodeDCFirst(BitReader& b, short* const block, int& previousDC, const HuffmanTable& dcTable, const unsigned int low) {
+    const int length = getNextSymbol(b, dcTable);
+    if (length == -1) {
+        JPEG_LOG_ERROR("Invalid DC value");
+        return false;
+    }
+    if (length > 11) {
+        JPEG_LOG_ERROR("DC coefficient length greater than 11");
+        return false;
+    }
+
+    previousDC += extendCoefficient(b.readBits(length), length);
+    block[0] = (short) (previousDC * (1 << low));
+    return true;
+}
+
+void decodeDCRefinement(BitReader& b, short* const block, const unsigned int low) {
+    if (b.readBits(1))
+        block[0] |= (short) (1 << low);
+}
+
+bool decodeACFirst(BitReader& b, short* const block, unsigned int& endOfBandRun, const HuffmanTable& acTable, const ScanHeader& scan) {
+    // blocks covered by an earlier end-of-band run have nothing coded
+    if (endOfBandRun > 0) {
+        --endOfBandRun;
+        return true;
+    }
+
+    for (unsigned int k = scan.startOfSelection; k <= scan.endOfSelection; ++k) {
+        const int symbol = getNextSymbol(b, acTable);
+        if (symbol == -1) {
+            JPEG_LOG_ERROR("Invalid AC value");
+            return false;
+        }
+
+        const unsigned int numZeros = symbol >> 4;
+        const unsigned int coefficientLength = symbol & 0x0F;
+        if (coefficientLength != 0) {
+            k += numZeros;
+            if (k > scan.endOfSelection) {
+                JPEG_LOG_ERROR("Zero run-length exceeded spectral band");
+                return false;
+            }
+            if (coefficientLength > 10) {
+                JPEG_LOG_ERROR("AC coefficient length greater than 10");
+                return false;
+            }
+            block[zigZagMap[k]] = (short) (extendCoefficient(b.readBits(coefficientLength), coefficientLength) * (1 << scan.successiveApproximationLow));
+        }
+        // 0xF0 skips 16 zeros
+        else if (numZeros == 15) {
+            k += 15;
+        }
+        // otherwise the band ends here in this block and the next 2^numZeros - 1 + extra bits
+        else {
+            endOfBandRun = (1u << numZeros) - 1;
+            if (numZeros != 0)
+                endOfBandRun += b.readBits(numZeros);
+            break;
+        }
+    }
+    return true;
+}
+
+// add the next bit of a coefficient already known to be nonzero
+void refineCoefficient(BitReader& b, short& coefficient, const int bit) {
+    if (b.readBits(1) && (coefficient & bit) == 0)
+        coefficient = (short) (coefficient >= 0 ? coefficient + bit : coefficient - bit);
+}
+
+bool decodeACRefinement(BitReader& b, short* const block, unsigned int& endOfBandRun, const HuffmanTable& acTable, const ScanHeader& scan) {
+    const int bit = 1 << scan.successiveApproximationLow;
+    unsigned int k = scan.startOfSelection;
+
+    if (endOfBandRun == 0) {
+        for (; k <= scan.endOfSelection; ++k) {
+            const int symbol = getNextSymbol(b, acTable);
+            if (symbol == -1) {
+                JPEG_LOG_ERROR("Invalid AC value");
+                return false;
+            }
+
+            unsigned int numZeros = symbol >> 4;
+            const unsigned int coefficientLength = symbol & 0x0F;
+            // a coefficient becoming nonzero this scan, which can only be +-1 at this precision
+            int value = 0;
+            if (coefficientLength != 0) {
+                if (coefficientLength != 1) {
+                    JPEG_LOG_ERROR("Invalid AC refinement value");
+                    return false;
+                }
+                value = b.readBits(1) ? bit : -bit;
+            }
+            else if (numZeros != 15) {
+                endOfBandRun = 1u << numZeros;
+                if (numZeros != 0)
+                    endOfBandRun += b.readBits(numZeros);
+                break;
+            }
+
+            // skip numZeros coefficients that are still zero, refining the nonzero ones on the way
+            for (; k <= scan.endOfSelection; ++k) {
+                short& coefficient = block[zigZagMap[k]];
+                if (coefficient != 0) {
+                    refineCoefficient(b, coefficient, bit);
+                }
+                else {
+                    if (numZeros == 0)
+                        break;
+                    --numZeros;
+                }
+            }
+            if (value != 0 && k <= scan.endOfSelection)
+                block[zigZagMap[k]] = (short) value;
+        }
+    }
+
+    // in an end-of-band run the rest of the band only refines coefficients already nonzero
+    if (endOfBandRun > 0) {
+        for (; k <= scan.endOfSelection; ++k) {
+            short& coefficient = block[zigZagMap[k]];
+            if (coefficient != 0)
+                refineCoefficient(b, coefficient, bit);
+        }
+        --endOfBandRun;
+    }
+    return true;
+}
+
+// decode the contribution of a scan to one block of its component index in the scan
+bool decodeProgressiveBlock(BitReader& b, const ScanHeader& scan, const unsigned int index, short* const block,
+                            int& previousDC, unsigned int& endOfBandRun) {
+    if (scan.startOfSelection == 0) {
+        if (scan.successiveApproximationHigh == 0)
+            return decodeDCFirst(b, block, previousDC, scan.huffmanTables[index], scan.successiveApproximationLow);
+        decodeDCRefinement(b, block, scan.successiveApproximationLow);
+        return true;
+    }
+    if (scan.successiveApproximationHigh == 0)
+        return decodeACFirst(b, block, endOfBandRun, scan.huffmanTables[index], scan);
+    return decodeACRefinement(b, block, endOfBandRun, scan.huffmanTables[index], scan);
+}
+
+// decode one scan of a progressive image into the band's image coefficients
+bool decodeScan(const Header* const header, const ScanHeader& scan, Band& band) {
+    BitReader reader(scan.data, scan.length);
+    int previousDCs[3] = {0};
+    unsigned int endOfBandRun = 0;
+
+    // a scan of several components is made of MCUs like a sequential image,
+    // one of a single component covers just the component's own blocks one at a time
+    const ColorComponent& first = header->colorComponents[scan.components[0]];
+    const unsigned int componentWidth = (header->width * first.horizontalSamplingFactor + header->horizontalSamplingFactor - 1) / header->horizontalSamplingFactor;
+    const unsigned int componentHeight = (header->height * first.verticalSamplingFactor + header->verticalSamplingFactor - 1) / header->verticalSamplingFactor;
+    const unsigned int unitsPerLine = scan.numComponents == 1 ? (componentWidth + 7) / 8 : header->mcuWidth;
+    const unsigned int numUnits = scan.numComponents == 1 ? unitsPerLine * ((componentHeight + 7) / 8) : header->mcuWidth * header->mcuHeight;
+
+    for (unsigned int i = 0; i < numUnits; ++i) {
+        // each restart interval starts byte aligned with the DC predictions and end-of-band run reset
+        if (scan.restartInterval != 0 && i != 0 && i % scan.restartInterval == 0) {
+            previousDCs[0] = 0;
+            previousDCs[1] = 0;
+            previousDCs[2] = 0;
+            endOfBandRun = 0;
+            reader.restart();
+        }
+
+        const unsigned int row = i / unitsPerLine;
+        const unsigned int column = i % unitsPerLine;
+        if (scan.numComponents == 1) {
+            ComponentBand& component = band.components[scan.components[0]];
+            short* const block = &component.imageCoefficients[((std::size_t) row * component.blocksPerLine + column) * 64];
+            if (!decodeProgressiveBlock(reader, scan, 0, block, previousDCs[0], endOfBandRun))
+                return false;
+            continue;
+        }
+
+        for (unsigned int j = 0; j < scan.numComponents; ++j) {
+            const ColorComponent& component = header->colorComponents[scan.components[j]];
+            ComponentBand& componentBand = band.components[scan.components[j]];
+            for (unsigned int v = 0; v < component.verticalSamplingFactor; ++v) {
+                for (unsigned int h = 0; h < component.horizontalSamplingFactor; ++h) {
+                    const std::size_t blockRow = row * component.verticalSamplingFactor + v;
+                    const std::size_t blockColumn = column * component.horizontalSamplingFactor + h;
+                    short* const block = &componentBand.imageCoefficients[(blockRow * componentBand.blocksPerLine + blockColumn) * 64];
+                    if (!decodeProgressiveBlock(reader, scan, j, block, previousDCs[j], endOfBandRun))
+                        return false;
+                }
+            }
+        }
+    }
+
+    if (reader.overrun()) {
+        JPEG_LOG_ERROR("Huffman data ended prematurely");
+        return false;
+    }
+    return true;
+}
+
+// dequantize and transform the blocks of the band's MCU columns into samples, one row of blocks at a time
+// transform MCU columns [firstColumn, lastColumn) of the band's MCU row mcuRow, of the first numComponents components
+void inverseDCTMCUs(const Header* const header, Band& band, const unsigned int mcuRow, const unsigned int firstColumn,
+                    const unsigned int lastColumn, const unsigned int numComponents) {
+    for (unsigned int j = 0; j < numComponents; ++j) {
+        const ColorComponent& colorComponent = header->colorComponents[j];
+        const short* const quantization = header->quantizationTables[colorComponent.quantizationTableID].multipliers;
+        ComponentBand& component = band.components[j];
+        const std::size_t firstBlock = (std::size_t) firstColumn * colorComponent.horizontalSamplingFactor;
+        const std::size_t numBlocks = (std::size_t) (lastColumn - firstColumn) * colorComponent.horizontalSamplingFactor;
+        const unsigned int lastBlockRow = (mcuRow + 1) * colorComponent.verticalSamplingFactor;
+        for (unsigned int y = mcuRow * colorComponent.verticalSamplingFactor; y < lastBlockRow; ++y) {
+            inverseDCTBlocksScaled(&component.coefficients[(y * component.blocksPerLine + firstBlock) * 64], numBlocks, component.blockSize, quantization,
+                                   &component.samples[y * component.blockSize * component.sampleStride() + firstBlock * component.blockSize],
+                                   component.sampleStride());
+        }
+    }
+}
+
+void inverseDCT(const Header* const header, Band& band, const unsigned int numMCURows, const bool luminanceOnly) {
+    for (unsigned int row = 0; row < numMCURows; ++row)
+        inverseDCTMCUs(header, band, row, band.firstMCUColumn, band.lastMCUColumn, luminanceOnly ? 1 : header->numComponents);
+}
+
+// convert rows [firstRow, lastRow) of the band from YCbCr to RGB, the length samples from first on,
+// first and length being multiples of 8
+void YCbCrToRGBRows(const Header* const header, Band& band, const unsigned int firstRow, const unsigned int lastRow,
+                    const std::size_t first, const std::size_t length) {
+    const ComponentBand& luminance = band.components[0];
+    const std::size_t stride = luminance.sampleStride();
+    const std::size_t chromaStride = band.components[1].sampleStride();
+    // chroma samples per luminance sample, which scaling may have made 1 even for subsampled chroma
+    const unsigned int horizontalFactor = (header->horizontalSamplingFactor * luminance.blockSize) /
+                                          (header->colorComponents[1].horizontalSamplingFactor * band.components[1].blockSize);
+    const unsigned int verticalFactor = (header->verticalSamplingFactor * luminance.blockSize) /
+                                        (header->colorComponents[1].verticalSamplingFactor * band.components[1].blockSize);
+    const std::size_t chromaFirst = first / horizontalFactor;
+
+    for (unsigned int y = firstRow; y < lastRow; ++y) {
+        const std::size_t offset = y * stride + first;
+        const std::size_t chromaOffset = (y / verticalFactor) * chromaStride + chromaFirst;
+        YCbCrToRGBRow(&luminance.samples[offset], &band.components[1].samples[chromaOffset], &band.components[2].samples[chromaOffset],
+                      &band.pixels[0][offset], &band.pixels[1][offset], &band.pixels[2][offset], length, horizontalFactor);
+    }
+}
+
+// the band's MCU columns as luminance samples, widened to whole groups of 8 for the row conversion
+void bandSampleColumns(const Header* const header, const Band& band, std::size_t& first, std::size_t& length) {
+    const std::size_t mcuPixelWidth = (std::size_t) header->horizontalSamplingFactor * band.components[0].blockSize;
+    first = (band.firstMCUColumn * mcuPixelWidth) & ~(std::size_t) 7;
+    length = std::min((band.lastMCUColumn * mcuPixelWidth + 7) & ~(std::size_t) 7, band.components[0].sampleStride()) - first;
+}
+
+// convert numRows rows of the band from YCbCr to RGB, upsampling chroma as it is read
+void YCbCrToRGB(const Header* const header, Band& band, const unsigned int numRows) {
+    std::size_t first, length;
+    bandSampleColumns(header, band, first, length);
+    YCbCrToRGBRows(header, band, 0, numRows, first, length);
+}
+
+// carry MCUs [first, last) of the image, decoded into the band, on to stage within the band's MCU columns
+void transformMCURange(const Header* const header, Band& band, const unsigned int first, const unsigned int last, const IntervalStage stage,
+                       DecodeStats* const stats) {
+    const unsigned int numComponents = stage == IntervalStage::Luminance ? 1 : header->numComponents;
+    const unsigned int mcuPixelWidth = header->horizontalSamplingFactor * band.components[0].blockSize;
+    const unsigned int mcuPixelHeight = header->verticalSamplingFactor * band.components[0].blockSize;
+    for (unsigned int i = first; i < last;) {
+        const unsigned int row = i / header->mcuWidth - band.firstMCURow;
+        const unsigned int column = i % header->mcuWidth;
+        const unsigned int lastColumn = std::min(header->mcuWidth, column + (last - i));
+        i += lastColumn - column;
+        const unsigned int from = std::max(column, band.firstMCUColumn);
+        const unsigned int to = std::min(lastColumn, band.lastMCUColumn);
+        if (from >= to)
+            continue;
+        {
+            JPEG_STATS_TIMER(stats, dequantIDCT);
+            inverseDCTMCUs(header, band, row, from, to, numComponents);
+        }
+        if (stage == IntervalStage::Pixels) {
+            JPEG_STATS_TIMER(stats, colorConvert);
+            const std::size_t firstSample = (std::size_t) from * mcuPixelWidth;
+            const std::size_t lastSample = std::min((std::size_t) to * mcuPixelWidth, band.components[0].sampleStride());
+            YCbCrToRGBRows(header, band, row * mcuPixelHeight, (row + 1) * mcuPixelHeight, firstSample, lastSample - firstSample);
+        }
+    }
+}
+
+bool decodeRestartIntervals(const Header* const header, const unsigned int first, const unsigned int last, Band& band, ThreadPool& pool,
+                            const IntervalStage stage, DecodeStats* const stats) {
+    const unsigned int firstInterval = first / header->restartInternal;
+    const unsigned int numIntervals = (last - first + header->restartInternal - 1) / header->restartInternal;
+    std::atomic<bool> failed(false);
+    // the threads' time in each stage, and the wall-clock time of them all
+    DecodeStats busy;
+    DecodeStats wall;
+    std::mutex busyMutex;
+
+    {
+        JPEG_STATS_TIMER(&wall, entropyDecode);
+        for (unsigned int k = 0; k < numIntervals; ++k) {
+            pool.submit([&, k] {
+                if (failed)
+                    return;
+                DecodeStats taskStats;
+                const unsigned int interval = firstInterval + k;
+                const std::size_t offset = (interval == 0) ? 0 : header->restartOffsets[interval - 1];
+                ScanState state(header->huffmanData + offset, header->huffmanDataLength - offset);
+                const unsigned int intervalFirst = interval * header->restartInternal;
+                const unsigned int intervalLast = std::min(intervalFirst + header->restartInternal, last);
+                bool success;
+                {
+                    JPEG_STATS_TIMER(&taskStats, entropyDecode);
+                    success = decodeMCURange(header, state, intervalFirst, intervalLast, band) && checkOverrun(state);
+                }
+                if (!success) {
+                    failed = true;
+                    return;
+                }
+                if (stage != IntervalStage::Coefficients)
+                    transformMCURange(header, band, intervalFirst, intervalLast, stage, &taskStats);
+                std::lock_guard<std::mutex> lock(busyMutex);
+                busy += taskStats;
+            });
+        }
+        pool.wait();
+    }
+
+    // the stages overlap across threads, so the wall-clock time is shared out between them
+    const double busyTime = busy.total();
+    if (busyTime > 0.0) {
+        JPEG_STATS_ADD(stats, entropyDecode, wall.entropyDecode * busy.entropyDecode / busyTime);
+        JPEG_STATS_ADD(stats, dequantIDCT, wall.entropyDecode * busy.dequantIDCT / busyTime);
+        JPEG_STATS_ADD(stats, colorConvert, wall.entropyDecode * busy.colorConvert / busyTime);
+    }
+    return !failed;
+}
+
+// convert numRows rows of the band from YCbCr to RGB, spread over the pool in bands of rows
+void YCbCrToRGB(const Header* const header, Band& band, const unsigned int numRows, ThreadPool& pool) {
+    std::size_t first, length;
+    bandSampleColumns(header, band, first, length);
+    const unsigned int rowsPerTask = (numRows + pool.size() - 1) / pool.size();
+    for (unsigned int row = 0; row < numRows; row += rowsPerTask) {
+        pool.submit([&, row] {
+            YCbCrToRGBRows(header, band, row, std::min(row + rowsPerTask, numRows), first, length);
+        });
+    }
+    pool.wait();
 }
 
 // helper function to write a 4-byte integer in little-endian
@@ -599,85 +1559,443 @@ void putShort(std::ofstream& outFile, const unsigned int v) {
     outFile.put((v >> 8) & 0xFF);
 }
 
-void writeBMP(const Header* const header, const MCU* const mcus, const std::string& filename) {
-    // open file
-    std::ofstream outFile = std::ofstream(filename, std::ios::out | std::ios::binary);
+bool BMPWriter::open(const std::string& filename, const unsigned int width, const unsigned int height, const bool gray) {
+    outFile.open(filename, std::ios::out | std::ios::binary);
     if (!outFile.is_open()) {
-        std::cout << "Error - Error opening output file\n";
-        return;
+        JPEG_LOG_ERROR("Error opening output file");
+        return false;
     }
 
-    const unsigned int mcuHeight = (header->height + 7) / 8;
-    const unsigned int mcuWidth = (header->width + 7) / 8;
-    const unsigned int paddingSize = header->width % 4;
-    const unsigned int size = 14 + 12 + header->height * header->width * 3 + paddingSize * header->height;
+    this->width = width;
+    this->height = height;
+    this->gray = gray;
+    rowSize = (width * (gray ? 1 : 3) + 3) / 4 * 4;
+    // 8-bit BMPs are followed by a palette of 256 BGR triples, here a gray ramp
+    dataOffset = headerSize + (gray ? 256 * 3 : 0);
+    const unsigned int size = dataOffset + height * rowSize;
 
     outFile.put('B');
     outFile.put('M');
     putInt(outFile, size);
     putInt(outFile, 0);
-    putInt(outFile, 0x1A);
+    putInt(outFile, dataOffset);
     putInt(outFile, 12);
-    putShort(outFile, header->width);
-    putShort(outFile, header->height);
+    putShort(outFile, width);
+    putShort(outFile, height);
     putShort(outFile, 1);
-    putShort(outFile, 24);
+    putShort(outFile, gray ? 8 : 24);
+    if (gray) {
+        for (unsigned int i = 0; i < 256; ++i) {
+            outFile.put((char) i);
+            outFile.put((char) i);
+            outFile.put((char) i);
+        }
+    }
+    return true;
+}
 
-    for (unsigned int y = header->height - 1; y < header->height; --y) {
-        const uint mcuRow = y / 8;
-        const uint pixelRow = y % 8;
-        for (unsigned int x = 0; x < header->width; ++x) {
-            const uint mcuColumn = x / 8;
-            const uint pixelColumn = x % 8;
-            const uint mcuIndex = mcuRow * mcuWidth + mcuColumn;
-            const uint pixelIndex = pixelRow * 8 + pixelColumn;
-            outFile.put(mcus[mcuIndex].b[pixelIndex]);
-            outFile.put(mcus[mcuIndex].g[pixelIndex]);
-            outFile.put(mcus[mcuIndex].r[pixelIndex]);
+bool BMPWriter::writeBand(const unsigned char* const* const planes, const unsigned int numPlanes, const std::size_t stride,
+                          const unsigned int firstRow, const unsigned int numRows) {
+    band.resize((std::size_t) numRows * rowSize);
+
+    for (unsigned int y = 0; y < numRows; ++y) {
+        // bottom-up: the last row of the band comes first
+        unsigned char* out = band.data() + (std::size_t) (numRows - 1 - y) * rowSize;
+        if (gray) {
+            std::memcpy(out, planes[0] + y * stride, width);
+            std::memset(out + width, 0, rowSize - width);
+            continue;
         }
-        for (unsigned int i = 0; i < paddingSize; ++i) {
-            outFile.put(0);
+        const unsigned char* const r = planes[0] + y * stride;
+        const unsigned char* const g = planes[numPlanes == 3 ? 1 : 0] + y * stride;
+        const unsigned char* const b = planes[numPlanes == 3 ? 2 : 0] + y * stride;
+        for (unsigned int x = 0; x < width; ++x) {
+            *out++ = b[x];
+            *out++ = g[x];
+            *out++ = r[x];
         }
+        std::memset(out, 0, rowSize - width * 3);
     }
 
+    outFile.seekp(dataOffset + (std::size_t) (height - firstRow - numRows) * rowSize);
+    outFile.write(reinterpret_cast<const char*>(band.data()), band.size());
+    return (bool) outFile;
+}
+
+bool BMPWriter::close() {
     outFile.close();
+    return !outFile.fail();
 }
 
-int main(int argc, char *argv[])
-{
-    if (argc < 2) {
-        std::cout << "Invalid arguments\n";
-        return 1;
+unsigned int bytesPerPixel(const PixelFormat format) {
+    switch (format) {
+        case PixelFormat::RGB24:
+        case PixelFormat::BGR24:
+            return 3;
+        case PixelFormat::RGBA32:
+        case PixelFormat::BGRA32:
+            return 4;
+        case PixelFormat::GRAY8:
+            return 1;
     }
-    for (int i = 1; i < argc; ++i) {
-        const std::string filename(argv[1]);
-        Header *header = readJPG(filename);
+    return 0;
+}
 
-        if (header == nullptr)
-            continue;
+bool BufferWriter::writeBand(const unsigned char* const* const planes, const unsigned int numPlanes, const std::size_t planeStride,
+                             const unsigned int firstRow, const unsigned int numRows) {
+    for (unsigned int y = 0; y < numRows; ++y) {
+        unsigned char* out = pixels + (std::size_t) (firstRow + y) * stride;
+        const unsigned char* const r = planes[0] + y * planeStride;
+        const unsigned char* const g = planes[numPlanes == 3 ? 1 : 0] + y * planeStride;
+        const unsigned char* const b = planes[numPlanes == 3 ? 2 : 0] + y * planeStride;
+        switch (format) {
+            case PixelFormat::RGB24:
+                for (unsigned int x = 0; x < width; ++x, out += 3) {
+                    out[0] = r[x];
+                    out[1] = g[x];
+                    out[2] = b[x];
+                }
+                break;
+            case PixelFormat::BGR24:
+                for (unsigned int x = 0; x < width; ++x, out += 3) {
+                    out[0] = b[x];
+                    out[1] = g[x];
+                    out[2] = r[x];
+                }
+                break;
+            case PixelFormat::RGBA32:
+                for (unsigned int x = 0; x < width; ++x, out += 4) {
+                    out[0] = r[x];
+                    out[1] = g[x];
+                    out[2] = b[x];
+                    out[3] = 255;
+                }
+                break;
+            case PixelFormat::BGRA32:
+                for (unsigned int x = 0; x < width; ++x, out += 4) {
+                    out[0] = b[x];
+                    out[1] = g[x];
+                    out[2] = r[x];
+                    out[3] = 255;
+                }
+                break;
+            // wantsGray() means planes[0] is always luminance here
+            case PixelFormat::GRAY8:
+                std::memcpy(out, r, width);
+                break;
+        }
+    }
+    return true;
+}
+
+bool StreamWriter::open(const int fd, const unsigned int width, const unsigned int height, const PixelFormat format, const bool pnm) {
+    this->fd = fd;
+    this->width = width;
+    this->format = format;
+    nextRow = 0;
+    if (!pnm)
+        return true;
+
+    if (format != PixelFormat::RGB24 && format != PixelFormat::GRAY8) {
+        JPEG_LOG_ERROR("PPM and PGM output need RGB24 or GRAY8 pixels");
+        return false;
+    }
+    const std::string header = std::string(format == PixelFormat::GRAY8 ? "P5\n" : "P6\n") + std::to_string(width) + " " +
+                               std::to_string(height) + "\n255\n";
+    return writeAll(reinterpret_cast<const unsigned char*>(header.data()), header.size());
+}
 
-        if (!header->valid) {
-            std::cout << "Error - Invalid JPEG\n";
-            delete header;
+bool StreamWriter::writeBand(const unsigned char* const* const planes, const unsigned int numPlanes, const std::size_t stride,
+                             const unsigned int firstRow, const unsigned int numRows) {
+    if (firstRow != nextRow) {
+        JPEG_LOG_ERROR("Bands out of order for a stream");
+        return false;
+    }
+    const std::size_t rowSize = (std::size_t) width * bytesPerPixel(format);
+    band.resize(rowSize * numRows);
+    BufferWriter rows(band.data(), rowSize, format, width);
+    rows.writeBand(planes, numPlanes, stride, 0, numRows);
+    nextRow += numRows;
+    return writeAll(band.data(), band.size());
+}
+
+bool StreamWriter::writeAll(const unsigned char* data, std::size_t size) {
+    while (size > 0) {
+        const ssize_t count = ::write(fd, data, size);
+        if (count < 0 && errno == EINTR)
             continue;
+        if (count <= 0) {
+            JPEG_LOG_ERROR("Error writing output");
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+// turn MCU rows [row, row + numRows) of coefficients in the band into pixels and write them,
+// or only write them if the restart interval tasks have done the rest
+JPEGError outputBand(const Header* const header, Band& band, BandWriter& writer, const unsigned int row, const unsigned int numRows,
+                     DecodeStats* const stats, const bool transformed = false) {
+    // the pixel rows of the band inside the output window
+    const unsigned int mcuPixelHeight = band.components[0].blockSize * header->verticalSamplingFactor;
+    const unsigned int bandTop = row * mcuPixelHeight;
+    const unsigned int top = std::max(bandTop, header->cropY);
+    const unsigned int bottom = std::min(bandTop + numRows * mcuPixelHeight, header->cropY + header->outputHeight);
+    if (top >= bottom)
+        return JPEGError::None;
+
+    if (!transformed) {
+        JPEG_STATS_TIMER(stats, dequantIDCT);
+        // chroma is not needed for gray output
+        inverseDCT(header, band, numRows, writer.wantsGray());
+    }
+
+    const std::size_t stride = band.components[0].sampleStride();
+    const std::size_t offset = (top - bandTop) * stride + header->cropX;
+    bool success;
+    if (header->numComponents == 3 && !writer.wantsGray()) {
+        if (!transformed) {
+            JPEG_STATS_TIMER(stats, colorConvert);
+            YCbCrToRGB(header, band, bottom - bandTop);
         }
+        const unsigned char* const planes[3] = {band.pixels[0].data() + offset, band.pixels[1].data() + offset, band.pixels[2].data() + offset};
+        JPEG_STATS_TIMER(stats, write);
+        success = writer.writeBand(planes, 3, stride, top - header->cropY, bottom - top);
+    }
+    // grayscale, or gray output wanted: the luminance samples are the output
+    else {
+        const unsigned char* const planes[1] = {band.components[0].samples.data() + offset};
+        JPEG_STATS_TIMER(stats, write);
+        success = writer.writeBand(planes, 1, stride, top - header->cropY, bottom - top);
+    }
+    if (!success) {
+        JPEG_LOG_ERROR("Error writing output file");
+        return JPEGError::WriteError;
+    }
+    return JPEGError::None;
+}
 
-        printHeader(header);
+// the MCU rows [firstRow, lastRow) the output window covers; the band is set to the MCU columns it covers
+void setOutputWindow(const Header* const header, Band& band, unsigned int& firstRow, unsigned int& lastRow) {
+    const unsigned int mcuPixelWidth = header->horizontalSamplingFactor * band.components[0].blockSize;
+    const unsigned int mcuPixelHeight = header->verticalSamplingFactor * band.components[0].blockSize;
+    band.firstMCUColumn = header->cropX / mcuPixelWidth;
+    band.lastMCUColumn = (header->cropX + header->outputWidth + mcuPixelWidth - 1) / mcuPixelWidth;
+    firstRow = header->cropY / mcuPixelHeight;
+    lastRow = (header->cropY + header->outputHeight + mcuPixelHeight - 1) / mcuPixelHeight;
+}
 
-        // TODO:  decode Huffman data
-        MCU* mcus = blackBox(header);
-        if (mcus == nullptr) {
-            delete header;
-            continue;
+JPEGError decodePreview(const Header* const header, Band& band, unsigned int numScans, BandWriter& writer, DecodeStats* const stats) {
+    if (!header->valid)
+        return header->error;
+    if (header->frameType != SOF2)
+        return decodeImage(header, band, writer, 1, stats);
+
+    const unsigned int previousAllocations = band.allocations;
+    if (!band.allocate(header, 1))
+        return JPEGError::OutOfMemory;
+    JPEG_STATS_ADD(stats, allocations, band.allocations - previousAllocations);
+    JPEG_STATS_ADD(stats, mcus, header->mcuWidth * header->mcuHeight);
+    JPEG_STATS_ADD(stats, pixelsOut, (std::uint64_t) header->outputWidth * header->outputHeight);
+
+    // every scan refines the coefficients the previous ones left, starting from zero
+    numScans = std::min(numScans, (unsigned int) header->scans.size());
+    if (band.scansDecoded == 0 || band.scansDecoded > numScans) {
+        for (unsigned int j = 0; j < header->numComponents; ++j)
+            std::fill(band.components[j].imageCoefficients.begin(), band.components[j].imageCoefficients.end(), 0);
+        band.scansDecoded = 0;
+    }
+    {
+        JPEG_STATS_TIMER(stats, entropyDecode);
+        for (; band.scansDecoded < numScans; ++band.scansDecoded) {
+            if (!decodeScan(header, header->scans[band.scansDecoded], band)) {
+                band.scansDecoded = 0;
+                return JPEGError::InvalidData;
+            }
+        }
+    }
+
+    // the image coefficients are left as they are for later scans, each band works on a copy
+    unsigned int firstRow, lastRow;
+    setOutputWindow(header, band, firstRow, lastRow);
+    for (unsigned int row = firstRow; row < lastRow; ++row) {
+        band.firstMCURow = row;
+        for (unsigned int j = 0; j < header->numComponents; ++j) {
+            ComponentBand& component = band.components[j];
+            const std::size_t bandSize = (std::size_t) component.blocksPerLine * header->colorComponents[j].verticalSamplingFactor * 64;
+            std::copy(component.imageCoefficients.begin() + row * bandSize, component.imageCoefficients.begin() + (row + 1) * bandSize,
+                      component.coefficients.begin());
         }
+        const JPEGError error = outputBand(header, band, writer, row, 1, stats);
+        if (error != JPEGError::None)
+            return error;
+    }
+    return JPEGError::None;
+}
+
+// decode the image band by band and hand each band of pixels to the writer
+// only one band of MCUs is held in memory at a time
+// numThreads caps the threads used to decode restart intervals in parallel
+// the same with the pool restart intervals are decoded on, created or resized only when needed
+JPEGError decodeImage(const Header* const header, Band& band, BandWriter& writer, const unsigned int numThreads,
+                      std::unique_ptr<ThreadPool>& pool, DecodeStats* const stats) {
+    if (!header->valid)
+        return header->error;
+    // progressive images are decoded scan by scan into coefficients for the whole image first
+    if (header->frameType == SOF2) {
+        band.scansDecoded = 0;
+        return decodePreview(header, band, (unsigned int) header->scans.size(), writer, stats);
+    }
 
-        // write BMP file
-        const std::size_t pos = filename.find_last_of('.');
-        const std::string outFilename = (pos == std::string::npos) ? (filename + ".bmp") : (filename.substr(0, pos) + ".bmp");
-        writeBMP(header, mcus, outFilename);
+    const unsigned int mcuHeight = header->mcuHeight;
+    const unsigned int mcuWidth = header->mcuWidth;
+    const unsigned int numMCUs = mcuHeight * mcuWidth;
+    const unsigned int restartInterval = header->restartInternal;
+
+    // restart intervals can be decoded independently if every RSTN marker is where it should be
+    // and band boundaries can be made to coincide with interval boundaries
+    const bool intervalsIndexed = restartInterval != 0 && header->restartOffsets.size() == (numMCUs - 1) / restartInterval;
+    unsigned int bandRows = 1;
+    bool parallel = false;
+    if (intervalsIndexed && numThreads > 1 && numMCUs >= minMCUsForParallelDecode) {
+        unsigned int a = restartInterval, b = mcuWidth;
+        while (b != 0) {
+            const unsigned int t = a % b;
+            a = b;
+            b = t;
+        }
+        const unsigned int alignedRows = restartInterval / a;
+        if (alignedRows <= maxBandRows) {
+            parallel = true;
+            // aim for a couple of intervals per thread in each band
+            const unsigned int targetMCUs = std::max(2 * numThreads * restartInterval, minMCUsForParallelDecode);
+            const unsigned int alignedMCUs = alignedRows * mcuWidth;
+            const unsigned int multiple = std::max(1u, std::min((targetMCUs + alignedMCUs - 1) / alignedMCUs, maxBandRows / alignedRows));
+            bandRows = std::min(alignedRows * multiple, mcuHeight);
+        }
+    }
 
-        delete[] mcus;
-        delete header;
+    const unsigned int previousAllocations = band.allocations;
+    if (!band.allocate(header, bandRows))
+        return JPEGError::OutOfMemory;
+    JPEG_STATS_ADD(stats, allocations, band.allocations - previousAllocations);
+    JPEG_STATS_ADD(stats, mcus, numMCUs);
+    JPEG_STATS_ADD(stats, restartIntervals, restartInterval == 0 ? 0 : (numMCUs + restartInterval - 1) / restartInterval);
+    JPEG_STATS_ADD(stats, pixelsOut, (std::uint64_t) header->outputWidth * header->outputHeight);
+
+    // when cropping, nothing past the window is decoded and, where restart intervals allow,
+    // nothing before the interval holding each of its rows' first MCU either
+    unsigned int firstRow, lastRow;
+    setOutputWindow(header, band, firstRow, lastRow);
+
+    // in parallel, the interval tasks take their MCUs as far as RGB where MCUs are whole groups of 8 samples
+    // for the row conversion; otherwise they stop at the samples and the rows are converted on the pool after
+    IntervalStage stage = IntervalStage::Coefficients;
+    bool convertOnPool = false;
+    if (parallel) {
+        if (pool == nullptr || pool->size() != numThreads)
+            pool.reset(new ThreadPool(numThreads));
+        const bool gray = header->numComponents == 1 || writer.wantsGray();
+        const unsigned int mcuPixelWidth = header->horizontalSamplingFactor * band.components[0].blockSize;
+        stage = gray ? IntervalStage::Luminance : (mcuPixelWidth % 8 == 0 ? IntervalStage::Pixels : IntervalStage::Samples);
+        convertOnPool = stage == IntervalStage::Samples;
     }
-    return 0;
+
+    ScanState state(header->huffmanData, header->huffmanDataLength);
+    // next MCU state would decode
+    unsigned int position = 0;
+    for (unsigned int row = parallel ? firstRow / bandRows * bandRows : firstRow; row < lastRow; row += bandRows) {
+        const unsigned int numRows = std::min(bandRows, mcuHeight - row);
+        const unsigned int first = row * mcuWidth;
+        const unsigned int last = first + numRows * mcuWidth;
+        band.firstMCURow = row;
+
+        // an interval running past its RSTN marker is as corrupt as a bad Huffman code
+        if (parallel && !decodeRestartIntervals(header, first, last, band, *pool, stage, stats))
+            return JPEGError::InvalidData;
+        if (convertOnPool) {
+            JPEG_STATS_TIMER(stats, colorConvert);
+            YCbCrToRGB(header, band, numRows * header->verticalSamplingFactor * band.components[0].blockSize, *pool);
+        }
+        if (!parallel) {
+            JPEG_STATS_TIMER(stats, entropyDecode);
+            for (unsigned int i = first; i < last; i += mcuWidth) {
+                if (!skipToMCU(header, state, position, i + band.firstMCUColumn, intervalsIndexed) ||
+                    !decodeMCURange(header, state, i + band.firstMCUColumn, i + band.lastMCUColumn, band)) {
+                    return JPEGError::InvalidData;
+                }
+                position = i + band.lastMCUColumn;
+            }
+        }
+
+        const JPEGError error = outputBand(header, band, writer, row, numRows, stats, parallel);
+        if (error != JPEGError::None)
+            return error;
+    }
+
+    if (!parallel && !checkOverrun(state))
+        return JPEGError::Truncated;
+
+    return JPEGError::None;
+}
+
+JPEGError decodeImage(const Header* const header, Band& band, BandWriter& writer, const unsigned int numThreads, DecodeStats* const stats) {
+    // kept for every band of the image
+    std::unique_ptr<ThreadPool> pool;
+    return decodeImage(header, band, writer, numThreads, pool, stats);
+}
+
+JPEGError decodeImage(const Header* const header, BandWriter& writer, const unsigned int numThreads, DecodeStats* const stats) {
+    if (!header->valid)
+        return header->error;
+    Band band;
+    return decodeImage(header, band, writer, numThreads, stats);
+}
+
+JPEGError decodeImage(const Header* const header, unsigned char* const pixels, const std::size_t stride, const PixelFormat format,
+                      const unsigned int numThreads, DecodeStats* const stats) {
+    if (!header->valid)
+        return header->error;
+    if (pixels == nullptr || stride < (std::size_t) header->outputWidth * bytesPerPixel(format)) {
+        JPEG_LOG_ERROR("Output buffer too small");
+        return JPEGError::InvalidArgument;
+    }
+    BufferWriter writer(pixels, stride, format, header->outputWidth);
+    return decodeImage(header, writer, numThreads, stats);
+}
+
+const Header* DecoderContext::read(const std::string& filename) {
+    resetHeader(&current);
+    band.scansDecoded = 0;
+    readJPG(filename, &current);
+    return &current;
+}
+
+JPEGError DecoderContext::decode(BandWriter& writer, const unsigned int numThreads, DecodeStats* const stats) {
+    if (!current.valid)
+        return current.error;
+    // carry on from a preview rather than decoding its scans again
+    if (current.frameType == SOF2)
+        return decodePreview((unsigned int) current.scans.size(), writer, stats);
+    return decodeImage(&current, band, writer, numThreads, pool, stats);
+}
+
+JPEGError DecoderContext::decode(unsigned char* const pixels, const std::size_t stride, const PixelFormat format,
+                                 const unsigned int numThreads, DecodeStats* const stats) {
+    if (!current.valid)
+        return current.error;
+    if (pixels == nullptr || stride < (std::size_t) current.outputWidth * bytesPerPixel(format)) {
+        JPEG_LOG_ERROR("Output buffer too small");
+        return JPEGError::InvalidArgument;
+    }
+    BufferWriter writer(pixels, stride, format, current.outputWidth);
+    return decode(writer, numThreads, stats);
+}
+
+JPEGError DecoderContext::decodePreview(const unsigned int numScans, BandWriter& writer, DecodeStats* const stats) {
+    if (!current.valid)
+        return current.error;
+    return ::decodePreview(&current, band, numScans, writer, stats);
 }
@@ -0,0 +1,298 @@
+#ifndef JPEGINCPLUSPLUS_DECODER_H
+#define JPEGINCPLUSPLUS_DECODER_H
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "JPEG.h"
+#include "BitReader.h"
+#include "Log.h"
+#include "Allocator.h"
+#include "ThreadPool.h"
+
+// The decoder stages, exposed one by one so they can be driven (and timed) separately.
+// decodeImage strings them together: entropy decoding into a band of coefficients,
+// dequantization and IDCT into 8-bit samples, color conversion and writing the band.
+
+// The decoding functions print nothing unless logging is enabled through Log.h. Failures are
+// reported through Header::valid and Header::error, JPEGInfo::error and decodeImage's result.
+
+const char* errorString(JPEGError error);
+
+// parse the markers and index the entropy-coded data; nullptr only on allocation failure
+Header* readJPG(const std::string& filename);
+
+// the same into a freshly constructed or reset header; returns header->valid
+bool readJPG(const std::string& filename, Header* header);
+
+// return a used header to its just-constructed state without giving up its buffers
+void resetHeader(Header* header);
+
+// only the frame and scan headers: dimensions, components, sampling factors and restart
+// interval, without looking at the compressed image data
+JPEGInfo probeJPG(const std::string& filename);
+
+// decode at 1/2, 1/4 or 1/8 of the size (or full size for 1) from each block's low-frequency
+// coefficients; sets outputWidth and outputHeight, rounded up. Returns false for other scales.
+bool setScale(Header* header, unsigned int scale);
+
+// decode only the width x height pixels at (x, y) of the image, scaled if it is; only the MCUs
+// the window touches are transformed, and restart intervals let the entropy decoder jump to them.
+// Returns false for an empty window or one reaching outside the image. setScale undoes it.
+bool setCrop(Header* header, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+void printHeader(const Header* header);
+
+// entropy decoder position carried from one band to the next
+struct ScanState {
+    BitReader reader;
+    int previousDCs[3] = {0};
+    // true while the reader sits at the start of a restart interval it was created for
+    bool fresh = true;
+
+    ScanState(const unsigned char* const data, const std::size_t length) : reader(data, length) {}
+};
+
+// coefficient blocks and 8-bit samples of one color component for a band of MCU rows
+struct ComponentBand {
+    unsigned int blocksPerLine = 0;
+    unsigned int blockRows = 0;
+    // samples across each block once decoded, 8 unless the image is scaled
+    unsigned int blockSize = 8;
+    // bit k set if the inverse DCT at blockSize reads zig-zag coefficient k; the entropy decoder stores only these
+    std::uint64_t coefficientMask = ~(std::uint64_t) 0;
+    // 64 coefficients per block, blocks in raster order
+    Buffer<short> coefficients;
+    // blocksPerLine * blockSize samples wide, padded to a multiple of 8 for the color conversion
+    Buffer<unsigned char> samples;
+    // progressive images only: the coefficients of the whole image, refined scan by scan
+    Buffer<short> imageCoefficients;
+
+    explicit ComponentBand(Allocator* const allocator = nullptr) :
+            coefficients(allocator), samples(allocator), imageCoefficients(allocator) {}
+
+    std::size_t sampleStride() const {
+        return ((std::size_t) blocksPerLine * blockSize + 7) & ~(std::size_t) 7;
+    }
+};
+
+// everything decoded for a band of MCU rows
+// allocate() only grows the buffers, so a band reused for another image normally allocates nothing
+struct Band {
+    unsigned int firstMCURow = 0;
+    // MCU columns [firstMCUColumn, lastMCUColumn) are decoded, all of them unless cropping
+    unsigned int firstMCUColumn = 0;
+    unsigned int lastMCUColumn = 0;
+    ComponentBand components[3];
+    // output R, G and B planes, as wide as the luminance samples; unused for grayscale
+    Buffer<unsigned char> pixels[3];
+    // buffers allocate() had to allocate or grow so far
+    unsigned int allocations = 0;
+    // progressive images only: scans already decoded into the image coefficients
+    unsigned int scansDecoded = 0;
+
+    explicit Band(Allocator* allocator = nullptr);
+
+    bool allocate(const Header* header, unsigned int numMCURows);
+};
+
+// decode MCUs [first, last) of the image into the band holding them
+bool decodeMCURange(const Header* header, ScanState& state, unsigned int first, unsigned int last, Band& band);
+
+// false if the reader ran past the end of its data
+bool checkOverrun(const ScanState& state);
+
+// how far each restart interval task takes its MCUs
+enum class IntervalStage {
+    Coefficients,   // entropy decoding only
+    Luminance,      // and the luminance's IDCT
+    Samples,        // and every component's IDCT
+    Pixels          // and the conversion to RGB; MCUs must be a multiple of 8 samples wide
+};
+
+// decode MCUs [first, last), both restart interval boundaries, one interval per task on the pool,
+// each task carrying its MCUs on to stage within the band's MCU columns
+// the time spent in each stage is added to stats, if given, in proportion to the threads' time in it
+bool decodeRestartIntervals(const Header* header, unsigned int first, unsigned int last, Band& band, ThreadPool& pool,
+                            IntervalStage stage = IntervalStage::Coefficients, DecodeStats* stats = nullptr);
+
+// decode one scan of a progressive image into the band's image coefficients
+bool decodeScan(const Header* header, const ScanHeader& scan, Band& band);
+
+// dequantize and transform the coefficients of numMCURows rows of the band into samples,
+// only the luminance's if luminanceOnly is set
+void inverseDCT(const Header* header, Band& band, unsigned int numMCURows, bool luminanceOnly = false);
+
+// convert numRows rows of the band from YCbCr to RGB, upsampling chroma as it is read
+void YCbCrToRGB(const Header* header, Band& band, unsigned int numRows);
+
+// destination of the decoded pixels, handed one band of rows at a time in decode order
+class BandWriter {
+public:
+    virtual ~BandWriter() = default;
+
+    // write image rows [firstRow, firstRow + numRows) from R, G and B planes, or one gray plane
+    virtual bool writeBand(const unsigned char* const* planes, unsigned int numPlanes, std::size_t stride,
+                           unsigned int firstRow, unsigned int numRows) = 0;
+
+    // true to be given the luminance plane of color images instead of RGB
+    virtual bool wantsGray() const {
+        return false;
+    }
+};
+
+// writes a BMP one band of MCU rows at a time, in decode order: 24-bit, or with gray set
+// 8-bit with a gray palette holding the luminance alone
+// BMP rows are stored bottom-up, so each band is written reversed at its final offset
+class BMPWriter : public BandWriter {
+public:
+    bool open(const std::string& filename, unsigned int width, unsigned int height, bool gray = false);
+
+    bool writeBand(const unsigned char* const* planes, unsigned int numPlanes, std::size_t stride,
+                   unsigned int firstRow, unsigned int numRows) override;
+
+    bool wantsGray() const override {
+        return gray;
+    }
+
+    bool close();
+
+private:
+    static const unsigned int headerSize = 0x1A;
+
+    std::ofstream outFile;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int rowSize = 0;
+    bool gray = false;
+    // headerSize plus the palette of an 8-bit BMP
+    unsigned int dataOffset = headerSize;
+    // one band of output rows, reused for every band
+    std::vector<unsigned char> band;
+};
+
+enum class PixelFormat {
+    RGB24,
+    BGR24,
+    RGBA32,
+    BGRA32,
+    GRAY8
+};
+
+unsigned int bytesPerPixel(PixelFormat format);
+
+// stores the decoded image in memory the caller owns, row y starting at pixels + y * stride
+// width is the header's outputWidth
+// alpha is always 255; GRAY8 of a color image is its luminance, RGB of a grayscale image is gray
+class BufferWriter : public BandWriter {
+public:
+    BufferWriter(unsigned char* const pixels, const std::size_t stride, const PixelFormat format, const unsigned int width) :
+            pixels(pixels), stride(stride), format(format), width(width) {}
+
+    bool writeBand(const unsigned char* const* planes, unsigned int numPlanes, std::size_t planeStride,
+                   unsigned int firstRow, unsigned int numRows) override;
+
+    bool wantsGray() const override {
+        return format == PixelFormat::GRAY8;
+    }
+
+private:
+    unsigned char* const pixels;
+    const std::size_t stride;
+    const PixelFormat format;
+    const unsigned int width;
+};
+
+// streams the image top-down to a file descriptor one band at a time, as it is decoded, and never
+// seeks, so it can feed a pipe: a binary PPM (P6) for RGB24 or PGM (P5) for GRAY8 if pnm is set,
+// otherwise headerless pixels in any format, laid out as BufferWriter lays them out
+class StreamWriter : public BandWriter {
+public:
+    // fd stays open, closing it is up to the caller
+    bool open(int fd, unsigned int width, unsigned int height, PixelFormat format, bool pnm);
+
+    bool writeBand(const unsigned char* const* planes, unsigned int numPlanes, std::size_t stride,
+                   unsigned int firstRow, unsigned int numRows) override;
+
+    bool wantsGray() const override {
+        return format == PixelFormat::GRAY8;
+    }
+
+private:
+    bool writeAll(const unsigned char* data, std::size_t size);
+
+    int fd = -1;
+    unsigned int width = 0;
+    PixelFormat format = PixelFormat::RGB24;
+    // first row not written yet; bands must come in order
+    unsigned int nextRow = 0;
+    // one band of output rows, reused for every band
+    std::vector<unsigned char> band;
+};
+
+// decode the image band by band and hand each band of pixels to the writer
+// numThreads caps the threads that decode, transform and convert restart intervals in parallel;
+// the writer is always called from the calling thread, one band at a time
+// the time spent in each stage and the work done are added to stats, if given
+// these and decodePreview return the error of a header that failed to read, decoding nothing
+JPEGError decodeImage(const Header* header, BandWriter& writer, unsigned int numThreads, DecodeStats* stats = nullptr);
+
+// the same with the caller's band buffers, which keep their capacity for the next image
+JPEGError decodeImage(const Header* header, Band& band, BandWriter& writer, unsigned int numThreads, DecodeStats* stats = nullptr);
+
+// progressive images: decode the first numScans scans, carrying on from the band.scansDecoded
+// already in the band, and write the image as far as they describe it; set band.scansDecoded
+// to 0 to start on a new image. Sequential images are decoded in full.
+JPEGError decodePreview(const Header* header, Band& band, unsigned int numScans, BandWriter& writer, DecodeStats* stats = nullptr);
+
+// decode straight into the caller's pixels, which must hold outputHeight rows of stride bytes,
+// stride being at least outputWidth * bytesPerPixel(format)
+JPEGError decodeImage(const Header* header, unsigned char* pixels, std::size_t stride, PixelFormat format,
+                      unsigned int numThreads, DecodeStats* stats = nullptr);
+
+// Decodes one image after another reusing the header (Huffman lookup tables
+// included) and band buffers of the previous one, so once the buffers have grown
+// to the largest image seen, decoding allocates nothing per image. One context
+// decodes one image at a time; use one per thread.
+class DecoderContext {
+public:
+    explicit DecoderContext(Allocator* const allocator = nullptr) : band(allocator) {}
+
+    DecoderContext(const DecoderContext&) = delete;
+    DecoderContext& operator=(const DecoderContext&) = delete;
+
+    // parse filename, replacing the previous image; check header()->valid
+    const Header* read(const std::string& filename);
+
+    // decode the image last read
+    JPEGError decode(BandWriter& writer, unsigned int numThreads, DecodeStats* stats = nullptr);
+    JPEGError decode(unsigned char* pixels, std::size_t stride, PixelFormat format, unsigned int numThreads,
+                     DecodeStats* stats = nullptr);
+
+    // write the image last read as far as its first numScans scans go; a progressive image's
+    // scans are decoded once, so successive previews and decode() only add the new ones
+    JPEGError decodePreview(unsigned int numScans, BandWriter& writer, DecodeStats* stats = nullptr);
+
+    // see setScale and setCrop; apply to the image last read
+    bool setScale(unsigned int scale) {
+        return ::setScale(&current, scale);
+    }
+
+    bool setCrop(unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+        return ::setCrop(&current, x, y, width, height);
+    }
+
+    const Header* header() const {
+        return &current;
+    }
+
+private:
+    Header current;
+    Band band;
+    // threads for restart intervals, kept from one image to the next
+    std::unique_ptr<ThreadPool> pool;
+};
+
+#endif //JPEGINCPLUSPLUS_DECODER_H
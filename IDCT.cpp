@@ -0,0 +1,394 @@
+#include "IDCT.h"
+#include "IDCTConstants.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// see IDCTConstants.h for the factorization and its constants
+
+static inline int clamp(const int value, const int low, const int high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+// a coefficient times its quantization multiplier, saturated to 16 bits
+static inline int dequantize(const short coefficient, const short multiplier) {
+    return clamp(coefficient * multiplier, -32768, 32767);
+}
+
+// one 1-D IDCT of in[0], in[stride], ..., in[7 * stride] with outputs still scaled by 2^13
+static inline void idct1D(const int* const in, const int stride, int* const out) {
+    const int in0 = in[0 * stride], in1 = in[1 * stride], in2 = in[2 * stride], in3 = in[3 * stride];
+    const int in4 = in[4 * stride], in5 = in[5 * stride], in6 = in[6 * stride], in7 = in[7 * stride];
+
+    const int tmp0 = (in0 + in4) * evenDC;
+    const int tmp1 = (in0 - in4) * evenDC;
+    const int tmp3 = in2 * even26 + in6 * even62;
+    const int tmp2 = in2 * even62 + in6 * even66;
+
+    const int tmp10 = tmp0 + tmp3;
+    const int tmp13 = tmp0 - tmp3;
+    const int tmp11 = tmp1 + tmp2;
+    const int tmp12 = tmp1 - tmp2;
+
+    int odd[4];
+    for (unsigned int i = 0; i < 4; ++i)
+        odd[i] = in7 * oddWeights[i][0] + in1 * oddWeights[i][1] + in3 * oddWeights[i][2] + in5 * oddWeights[i][3];
+
+    out[0] = tmp10 + odd[3];
+    out[7] = tmp10 - odd[3];
+    out[1] = tmp11 + odd[2];
+    out[6] = tmp11 - odd[2];
+    out[2] = tmp12 + odd[1];
+    out[5] = tmp12 - odd[1];
+    out[3] = tmp13 + odd[0];
+    out[4] = tmp13 - odd[0];
+}
+
+void inverseDCTBlockScalar(const short* const block, const short* const quantization, unsigned char* const out,
+                           const std::size_t outStride) {
+    int input[64];
+    for (unsigned int i = 0; i < 64; ++i)
+        input[i] = dequantize(block[i], quantization[i]);
+
+    // columns, kept with pass1Bits of extra precision
+    int workspace[64];
+    for (unsigned int x = 0; x < 8; ++x) {
+        int column[8];
+        idct1D(input + x, 8, column);
+        for (unsigned int y = 0; y < 8; ++y)
+            workspace[y * 8 + x] = clamp((column[y] + (1 << (pass1Shift - 1))) >> pass1Shift, -32768, 32767);
+    }
+
+    // rows, level shifted back to 0..255
+    for (unsigned int y = 0; y < 8; ++y) {
+        int row[8];
+        idct1D(workspace + y * 8, 1, row);
+        for (unsigned int x = 0; x < 8; ++x)
+            out[y * outStride + x] = (unsigned char) clamp(((row[x] + (1 << (pass2Shift - 1))) >> pass2Shift) + 128, 0, 255);
+    }
+}
+
+// Reduced-size transforms for scaled decoding, each producing size x size samples from
+// the low-frequency coefficients of a block (the same arithmetic as libjpeg's jidctred.c).
+// The coefficients are taken as if the block were sampled at the lower resolution.
+
+static constexpr int fix0_211164243 = fix(0.211164243);
+static constexpr int fix0_509795579 = fix(0.509795579);
+static constexpr int fix0_601344887 = fix(0.601344887);
+static constexpr int fix0_720959822 = fix(0.720959822);
+static constexpr int fix0_765366865 = fix(0.765366865);
+static constexpr int fix0_850430095 = fix(0.850430095);
+static constexpr int fix0_899976223 = fix(0.899976223);
+static constexpr int fix1_061594337 = fix(1.061594337);
+static constexpr int fix1_272758580 = fix(1.272758580);
+static constexpr int fix1_451774981 = fix(1.451774981);
+static constexpr int fix1_847759065 = fix(1.847759065);
+static constexpr int fix2_172734803 = fix(2.172734803);
+static constexpr int fix2_562915447 = fix(2.562915447);
+static constexpr int fix3_624509785 = fix(3.624509785);
+
+static inline int descale(const int value, const int shift) {
+    return (value + (1 << (shift - 1))) >> shift;
+}
+
+// 4-point IDCT from in[0], in[2], in[6] (even) and in[1], in[3], in[5], in[7] (odd), scaled by 2^14
+template <typename T>
+static inline void idct4(const T* const in, const int stride, int out[4]) {
+    const int tmp0 = (int) in[0] * (1 << (fixBits + 1));
+    const int tmp2 = (int) in[2 * stride] * fix1_847759065 - (int) in[6 * stride] * fix0_765366865;
+    const int tmp10 = tmp0 + tmp2;
+    const int tmp12 = tmp0 - tmp2;
+
+    const int z1 = in[7 * stride], z2 = in[5 * stride], z3 = in[3 * stride], z4 = in[stride];
+    const int odd0 = -z1 * fix0_211164243 + z2 * fix1_451774981 - z3 * fix2_172734803 + z4 * fix1_061594337;
+    const int odd2 = -z1 * fix0_509795579 - z2 * fix0_601344887 + z3 * fix0_899976223 + z4 * fix2_562915447;
+
+    out[0] = tmp10 + odd2;
+    out[3] = tmp10 - odd2;
+    out[1] = tmp12 + odd0;
+    out[2] = tmp12 - odd0;
+}
+
+void inverseDCTBlock4x4(const short* const block, const short* const quantization, unsigned char* const out,
+                        const std::size_t outStride) {
+    int input[64];
+    for (unsigned int i = 0; i < 64; ++i)
+        input[i] = dequantize(block[i], quantization[i]);
+
+    // column 4 does not contribute to the 4 samples of a row
+    int workspace[4 * 8];
+    for (unsigned int x = 0; x < 8; ++x) {
+        if (x == 4)
+            continue;
+        int column[4];
+        idct4(input + x, 8, column);
+        for (unsigned int y = 0; y < 4; ++y)
+            workspace[y * 8 + x] = clamp(descale(column[y], fixBits - pass1Bits + 1), -32768, 32767);
+    }
+
+    for (unsigned int y = 0; y < 4; ++y) {
+        int row[4];
+        idct4(workspace + y * 8, 1, row);
+        for (unsigned int x = 0; x < 4; ++x)
+            out[y * outStride + x] = (unsigned char) clamp(descale(row[x], fixBits + pass1Bits + 3 + 1) + 128, 0, 255);
+    }
+}
+
+// 2-point IDCT from in[0] and the odd inputs, scaled by 2^15
+template <typename T>
+static inline void idct2(const T* const in, const int stride, int out[2]) {
+    const int tmp10 = (int) in[0] * (1 << (fixBits + 2));
+    const int tmp0 = -(int) in[7 * stride] * fix0_720959822 + (int) in[5 * stride] * fix0_850430095 -
+                     (int) in[3 * stride] * fix1_272758580 + (int) in[stride] * fix3_624509785;
+    out[0] = tmp10 + tmp0;
+    out[1] = tmp10 - tmp0;
+}
+
+void inverseDCTBlock2x2(const short* const block, const short* const quantization, unsigned char* const out,
+                        const std::size_t outStride) {
+    int input[64];
+    for (unsigned int i = 0; i < 64; ++i)
+        input[i] = dequantize(block[i], quantization[i]);
+
+    // only the odd columns and column 0 contribute
+    int workspace[2 * 8];
+    for (unsigned int x = 0; x < 8; ++x) {
+        if (x != 0 && (x & 1) == 0)
+            continue;
+        int column[2];
+        idct2(input + x, 8, column);
+        workspace[x] = descale(column[0], fixBits - pass1Bits + 2);
+        workspace[8 + x] = descale(column[1], fixBits - pass1Bits + 2);
+    }
+
+    for (unsigned int y = 0; y < 2; ++y) {
+        int row[2];
+        idct2(workspace + y * 8, 1, row);
+        out[y * outStride] = (unsigned char) clamp(descale(row[0], fixBits + pass1Bits + 3 + 2) + 128, 0, 255);
+        out[y * outStride + 1] = (unsigned char) clamp(descale(row[1], fixBits + pass1Bits + 3 + 2) + 128, 0, 255);
+    }
+}
+
+void inverseDCTBlock1x1(const short* const block, const short* const quantization, unsigned char* const out, std::size_t) {
+    out[0] = (unsigned char) clamp(descale(dequantize(block[0], quantization[0]), 3) + 128, 0, 255);
+}
+
+#if defined(__SSE2__)
+
+// pmaddwd constant: lanes holding (x, y) pairs become x * a + y * b
+static inline __m128i pairConstant(const int a, const int b) {
+    return _mm_set1_epi32((int) (((unsigned int) b << 16) | ((unsigned int) a & 0xFFFF)));
+}
+
+// row y of a block times row y of its quantization multipliers, saturated to 16 bits
+static inline __m128i loadDequantizedSSE2(const short* const block, const short* const quantization, const unsigned int y) {
+    const __m128i coefficients = _mm_loadu_si128((const __m128i*) (block + y * 8));
+    const __m128i multipliers = _mm_loadu_si128((const __m128i*) (quantization + y * 8));
+    const __m128i low = _mm_mullo_epi16(coefficients, multipliers);
+    const __m128i high = _mm_mulhi_epi16(coefficients, multipliers);
+    return _mm_packs_epi32(_mm_unpacklo_epi16(low, high), _mm_unpackhi_epi16(low, high));
+}
+
+// one 1-D pass over four lanes given the interleaved input pairs; outputs are rounded by shift
+static inline void idctHalfSSE2(const __m128i p04, const __m128i p26, const __m128i p71, const __m128i p35,
+                                const int shift, __m128i out[8]) {
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+
+    const __m128i tmp0 = _mm_madd_epi16(p04, pairConstant(evenDC, evenDC));
+    const __m128i tmp1 = _mm_madd_epi16(p04, pairConstant(evenDC, -evenDC));
+    const __m128i tmp3 = _mm_madd_epi16(p26, pairConstant(even26, even62));
+    const __m128i tmp2 = _mm_madd_epi16(p26, pairConstant(even62, even66));
+
+    const __m128i tmp10 = _mm_add_epi32(_mm_add_epi32(tmp0, tmp3), round);
+    const __m128i tmp13 = _mm_add_epi32(_mm_sub_epi32(tmp0, tmp3), round);
+    const __m128i tmp11 = _mm_add_epi32(_mm_add_epi32(tmp1, tmp2), round);
+    const __m128i tmp12 = _mm_add_epi32(_mm_sub_epi32(tmp1, tmp2), round);
+
+    __m128i odd[4];
+    for (unsigned int i = 0; i < 4; ++i)
+        odd[i] = _mm_add_epi32(_mm_madd_epi16(p71, pairConstant(oddWeights[i][0], oddWeights[i][1])),
+                               _mm_madd_epi16(p35, pairConstant(oddWeights[i][2], oddWeights[i][3])));
+
+    out[0] = _mm_srai_epi32(_mm_add_epi32(tmp10, odd[3]), shift);
+    out[7] = _mm_srai_epi32(_mm_sub_epi32(tmp10, odd[3]), shift);
+    out[1] = _mm_srai_epi32(_mm_add_epi32(tmp11, odd[2]), shift);
+    out[6] = _mm_srai_epi32(_mm_sub_epi32(tmp11, odd[2]), shift);
+    out[2] = _mm_srai_epi32(_mm_add_epi32(tmp12, odd[1]), shift);
+    out[5] = _mm_srai_epi32(_mm_sub_epi32(tmp12, odd[1]), shift);
+    out[3] = _mm_srai_epi32(_mm_add_epi32(tmp13, odd[0]), shift);
+    out[4] = _mm_srai_epi32(_mm_sub_epi32(tmp13, odd[0]), shift);
+}
+
+// 1-D pass over eight lanes of 16-bit inputs, results saturated back to 16 bits
+static inline void idctPassSSE2(const __m128i in[8], const int shift, __m128i out[8]) {
+    __m128i low[8], high[8];
+    idctHalfSSE2(_mm_unpacklo_epi16(in[0], in[4]), _mm_unpacklo_epi16(in[2], in[6]),
+                 _mm_unpacklo_epi16(in[7], in[1]), _mm_unpacklo_epi16(in[3], in[5]), shift, low);
+    idctHalfSSE2(_mm_unpackhi_epi16(in[0], in[4]), _mm_unpackhi_epi16(in[2], in[6]),
+                 _mm_unpackhi_epi16(in[7], in[1]), _mm_unpackhi_epi16(in[3], in[5]), shift, high);
+    for (unsigned int i = 0; i < 8; ++i)
+        out[i] = _mm_packs_epi32(low[i], high[i]);
+}
+
+static inline void transposeSSE2(__m128i v[8]) {
+    const __m128i a0 = _mm_unpacklo_epi16(v[0], v[1]), a1 = _mm_unpackhi_epi16(v[0], v[1]);
+    const __m128i a2 = _mm_unpacklo_epi16(v[2], v[3]), a3 = _mm_unpackhi_epi16(v[2], v[3]);
+    const __m128i a4 = _mm_unpacklo_epi16(v[4], v[5]), a5 = _mm_unpackhi_epi16(v[4], v[5]);
+    const __m128i a6 = _mm_unpacklo_epi16(v[6], v[7]), a7 = _mm_unpackhi_epi16(v[6], v[7]);
+
+    const __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    const __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    const __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    const __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+    v[0] = _mm_unpacklo_epi64(b0, b4);
+    v[1] = _mm_unpackhi_epi64(b0, b4);
+    v[2] = _mm_unpacklo_epi64(b1, b5);
+    v[3] = _mm_unpackhi_epi64(b1, b5);
+    v[4] = _mm_unpacklo_epi64(b2, b6);
+    v[5] = _mm_unpackhi_epi64(b2, b6);
+    v[6] = _mm_unpacklo_epi64(b3, b7);
+    v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// 4-point pass over four lanes given the interleaved input pairs (in0, in2), (in6, in7), (in1, in3) and (in5, 0)
+static inline void idct4HalfSSE2(const __m128i p02, const __m128i p67, const __m128i p13, const __m128i p5z,
+                                 const int shift, __m128i out[4]) {
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+
+    const __m128i tmp10 = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(p02, pairConstant(1 << (fixBits + 1), fix1_847759065)),
+                                                      _mm_madd_epi16(p67, pairConstant(-fix0_765366865, 0))), round);
+    const __m128i tmp12 = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(p02, pairConstant(1 << (fixBits + 1), -fix1_847759065)),
+                                                      _mm_madd_epi16(p67, pairConstant(fix0_765366865, 0))), round);
+
+    const __m128i odd0 = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(p67, pairConstant(0, -fix0_211164243)),
+                                                     _mm_madd_epi16(p13, pairConstant(fix1_061594337, -fix2_172734803))),
+                                       _mm_madd_epi16(p5z, pairConstant(fix1_451774981, 0)));
+    const __m128i odd2 = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(p67, pairConstant(0, -fix0_509795579)),
+                                                     _mm_madd_epi16(p13, pairConstant(fix2_562915447, fix0_899976223))),
+                                       _mm_madd_epi16(p5z, pairConstant(-fix0_601344887, 0)));
+
+    out[0] = _mm_srai_epi32(_mm_add_epi32(tmp10, odd2), shift);
+    out[3] = _mm_srai_epi32(_mm_sub_epi32(tmp10, odd2), shift);
+    out[1] = _mm_srai_epi32(_mm_add_epi32(tmp12, odd0), shift);
+    out[2] = _mm_srai_epi32(_mm_sub_epi32(tmp12, odd0), shift);
+}
+
+void inverseDCTBlock4x4SSE2(const short* const block, const short* const quantization, unsigned char* const out,
+                            const std::size_t outStride) {
+    // row 4 does not contribute
+    __m128i rows[8];
+    for (unsigned int y = 0; y < 8; ++y)
+        rows[y] = y == 4 ? _mm_setzero_si128() : loadDequantizedSSE2(block, quantization, y);
+
+    // columns, all eight at once, into four rows saturated to 16 bits
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low[4], high[4];
+    idct4HalfSSE2(_mm_unpacklo_epi16(rows[0], rows[2]), _mm_unpacklo_epi16(rows[6], rows[7]),
+                  _mm_unpacklo_epi16(rows[1], rows[3]), _mm_unpacklo_epi16(rows[5], zero), fixBits - pass1Bits + 1, low);
+    idct4HalfSSE2(_mm_unpackhi_epi16(rows[0], rows[2]), _mm_unpackhi_epi16(rows[6], rows[7]),
+                  _mm_unpackhi_epi16(rows[1], rows[3]), _mm_unpackhi_epi16(rows[5], zero), fixBits - pass1Bits + 1, high);
+    __m128i workspace[8];
+    for (unsigned int i = 0; i < 4; ++i) {
+        workspace[i] = _mm_packs_epi32(low[i], high[i]);
+        workspace[i + 4] = zero;
+    }
+
+    // rows, one per lane; the transpose leaves input x of row y in lane y of workspace[x]
+    transposeSSE2(workspace);
+    __m128i columns[4];
+    idct4HalfSSE2(_mm_unpacklo_epi16(workspace[0], workspace[2]), _mm_unpacklo_epi16(workspace[6], workspace[7]),
+                  _mm_unpacklo_epi16(workspace[1], workspace[3]), _mm_unpacklo_epi16(workspace[5], zero),
+                  fixBits + pass1Bits + 3 + 1, columns);
+
+    // gather output column c of each row back into rows, level shifted and clamped to 0..255
+    const __m128i center = _mm_set1_epi16(128);
+    const __m128i a = _mm_add_epi16(_mm_packs_epi32(columns[0], columns[1]), center);
+    const __m128i b = _mm_add_epi16(_mm_packs_epi32(columns[2], columns[3]), center);
+    const __m128i c = _mm_unpacklo_epi16(a, b);
+    const __m128i d = _mm_unpackhi_epi16(a, b);
+    __m128i samples = _mm_packus_epi16(_mm_unpacklo_epi16(c, d), _mm_unpackhi_epi16(c, d));
+    for (unsigned int y = 0; y < 4; ++y) {
+        const int row = _mm_cvtsi128_si32(samples);
+        std::memcpy(out + y * outStride, &row, 4);
+        samples = _mm_srli_si128(samples, 4);
+    }
+}
+
+void inverseDCTBlockSSE2(const short* const block, const short* const quantization, unsigned char* const out,
+                         const std::size_t outStride) {
+    __m128i rows[8];
+    for (unsigned int y = 0; y < 8; ++y)
+        rows[y] = loadDequantizedSSE2(block, quantization, y);
+
+    __m128i workspace[8];
+    idctPassSSE2(rows, pass1Shift, workspace);
+    transposeSSE2(workspace);
+    idctPassSSE2(workspace, pass2Shift, rows);
+
+    // packing to unsigned bytes clamps to 0..255
+    const __m128i center = _mm_set1_epi16(128);
+    for (unsigned int i = 0; i < 8; ++i)
+        rows[i] = _mm_add_epi16(rows[i], center);
+    transposeSSE2(rows);
+
+    for (unsigned int y = 0; y < 8; ++y)
+        _mm_storel_epi64((__m128i*) (out + y * outStride), _mm_packus_epi16(rows[y], rows[y]));
+}
+
+#endif
+
+static SIMDLevel currentKernel = bestSIMDLevel();
+
+bool setIDCTKernel(const SIMDLevel level) {
+    if (!supportsSIMDLevel(level))
+        return false;
+    currentKernel = level;
+    return true;
+}
+
+SIMDLevel getIDCTKernel() {
+    return currentKernel;
+}
+
+void inverseDCTBlocks(const short* const blocks, const std::size_t count, const short* const quantization, unsigned char* const out,
+                      const std::size_t outStride) {
+    std::size_t i = 0;
+    switch (currentKernel) {
+#ifdef JPEG_HAVE_AVX2
+        case SIMDLevel::AVX2:
+            for (; i + 1 < count; i += 2)
+                inverseDCTBlockPairAVX2(blocks + i * 64, blocks + (i + 1) * 64, quantization, out + i * 8, out + (i + 1) * 8, outStride);
+            // an odd block out falls through to SSE2
+            // fall through
+#endif
+#if defined(__SSE2__)
+        case SIMDLevel::SSE2:
+            for (; i < count; ++i)
+                inverseDCTBlockSSE2(blocks + i * 64, quantization, out + i * 8, outStride);
+            break;
+#endif
+        default:
+            for (; i < count; ++i)
+                inverseDCTBlockScalar(blocks + i * 64, quantization, out + i * 8, outStride);
+            break;
+    }
+}
+
+void inverseDCTBlocksScaled(const short* const blocks, const std::size_t count, const unsigned int size, const short* const quantization,
+                            unsigned char* const out, const std::size_t outStride) {
+    if (size == 8) {
+        inverseDCTBlocks(blocks, count, quantization, out, outStride);
+        return;
+    }
+    void (*kernel)(const short*, const short*, unsigned char*, std::size_t) =
+            size == 4 ? inverseDCTBlock4x4 : (size == 2 ? inverseDCTBlock2x2 : inverseDCTBlock1x1);
+#if defined(__SSE2__)
+    if (size == 4 && currentKernel != SIMDLevel::Scalar)
+        kernel = inverseDCTBlock4x4SSE2;
+#endif
+    for (std::size_t i = 0; i < count; ++i)
+        kernel(blocks + i * 64, quantization, out + i * size, outStride);
+}
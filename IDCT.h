@@ -0,0 +1,48 @@
+#ifndef JPEGINCPLUSPLUS_IDCT_H
+#define JPEGINCPLUSPLUS_IDCT_H
+
+#include <cstddef>
+#include "SIMD.h"
+
+// Separable integer inverse DCT (Loeffler-Ligtenberg-Moschytz, 13-bit constants)
+// over blocks of 64 quantized 16-bit coefficients in natural order. Each block
+// becomes 8x8 level-shifted samples written to an 8-bit plane with the given row stride.
+//
+// Dequantization is part of the transform: the coefficients are multiplied by the
+// 16-bit quantization multipliers (QuantizationTable::multipliers) as they are loaded.
+//
+// All implementations compute exactly the same integer arithmetic: the products
+// and the column pass are rounded and saturated to 16 bits, and the row pass is
+// rounded and clamped to 0..255, so their output is bit-identical.
+
+// kernel used by inverseDCTBlocks, defaults to bestSIMDLevel()
+// returns false if the level is not supported here
+bool setIDCTKernel(SIMDLevel level);
+SIMDLevel getIDCTKernel();
+
+// transform a row of count consecutive blocks, block i landing at out + i * 8
+void inverseDCTBlocks(const short* blocks, std::size_t count, const short* quantization, unsigned char* out, std::size_t outStride);
+
+// the same with each block reduced to size x size samples (size 8, 4, 2 or 1), block i landing at out + i * size
+void inverseDCTBlocksScaled(const short* blocks, std::size_t count, unsigned int size, const short* quantization,
+                            unsigned char* out, std::size_t outStride);
+
+void inverseDCTBlockScalar(const short* block, const short* quantization, unsigned char* out, std::size_t outStride);
+
+// reduced transforms from the low-frequency coefficients
+void inverseDCTBlock4x4(const short* block, const short* quantization, unsigned char* out, std::size_t outStride);
+void inverseDCTBlock2x2(const short* block, const short* quantization, unsigned char* out, std::size_t outStride);
+void inverseDCTBlock1x1(const short* block, const short* quantization, unsigned char* out, std::size_t outStride);
+
+#if defined(__SSE2__)
+void inverseDCTBlockSSE2(const short* block, const short* quantization, unsigned char* out, std::size_t outStride);
+void inverseDCTBlock4x4SSE2(const short* block, const short* quantization, unsigned char* out, std::size_t outStride);
+#endif
+
+#ifdef JPEG_HAVE_AVX2
+// two blocks with the same quantization at once, one per 128-bit lane
+void inverseDCTBlockPairAVX2(const short* first, const short* second, const short* quantization, unsigned char* outFirst,
+                             unsigned char* outSecond, std::size_t outStride);
+#endif
+
+#endif //JPEGINCPLUSPLUS_IDCT_H
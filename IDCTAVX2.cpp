@@ -0,0 +1,104 @@
+// built with -mavx2 and only called after a runtime CPU check, see IDCT.cpp
+
+#include "IDCT.h"
+#include "IDCTConstants.h"
+
+#include <immintrin.h>
+
+// AVX2 integer instructions work within 128-bit lanes, so this is the SSE2
+// kernel with one block in each lane.
+
+static inline __m256i pairConstant(const int a, const int b) {
+    return _mm256_set1_epi32((int) (((unsigned int) b << 16) | ((unsigned int) a & 0xFFFF)));
+}
+
+static inline void idctHalfAVX2(const __m256i p04, const __m256i p26, const __m256i p71, const __m256i p35,
+                                const int shift, __m256i out[8]) {
+    const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+
+    const __m256i tmp0 = _mm256_madd_epi16(p04, pairConstant(evenDC, evenDC));
+    const __m256i tmp1 = _mm256_madd_epi16(p04, pairConstant(evenDC, -evenDC));
+    const __m256i tmp3 = _mm256_madd_epi16(p26, pairConstant(even26, even62));
+    const __m256i tmp2 = _mm256_madd_epi16(p26, pairConstant(even62, even66));
+
+    const __m256i tmp10 = _mm256_add_epi32(_mm256_add_epi32(tmp0, tmp3), round);
+    const __m256i tmp13 = _mm256_add_epi32(_mm256_sub_epi32(tmp0, tmp3), round);
+    const __m256i tmp11 = _mm256_add_epi32(_mm256_add_epi32(tmp1, tmp2), round);
+    const __m256i tmp12 = _mm256_add_epi32(_mm256_sub_epi32(tmp1, tmp2), round);
+
+    __m256i odd[4];
+    for (unsigned int i = 0; i < 4; ++i)
+        odd[i] = _mm256_add_epi32(_mm256_madd_epi16(p71, pairConstant(oddWeights[i][0], oddWeights[i][1])),
+                                  _mm256_madd_epi16(p35, pairConstant(oddWeights[i][2], oddWeights[i][3])));
+
+    out[0] = _mm256_srai_epi32(_mm256_add_epi32(tmp10, odd[3]), shift);
+    out[7] = _mm256_srai_epi32(_mm256_sub_epi32(tmp10, odd[3]), shift);
+    out[1] = _mm256_srai_epi32(_mm256_add_epi32(tmp11, odd[2]), shift);
+    out[6] = _mm256_srai_epi32(_mm256_sub_epi32(tmp11, odd[2]), shift);
+    out[2] = _mm256_srai_epi32(_mm256_add_epi32(tmp12, odd[1]), shift);
+    out[5] = _mm256_srai_epi32(_mm256_sub_epi32(tmp12, odd[1]), shift);
+    out[3] = _mm256_srai_epi32(_mm256_add_epi32(tmp13, odd[0]), shift);
+    out[4] = _mm256_srai_epi32(_mm256_sub_epi32(tmp13, odd[0]), shift);
+}
+
+static inline void idctPassAVX2(const __m256i in[8], const int shift, __m256i out[8]) {
+    __m256i low[8], high[8];
+    idctHalfAVX2(_mm256_unpacklo_epi16(in[0], in[4]), _mm256_unpacklo_epi16(in[2], in[6]),
+                 _mm256_unpacklo_epi16(in[7], in[1]), _mm256_unpacklo_epi16(in[3], in[5]), shift, low);
+    idctHalfAVX2(_mm256_unpackhi_epi16(in[0], in[4]), _mm256_unpackhi_epi16(in[2], in[6]),
+                 _mm256_unpackhi_epi16(in[7], in[1]), _mm256_unpackhi_epi16(in[3], in[5]), shift, high);
+    for (unsigned int i = 0; i < 8; ++i)
+        out[i] = _mm256_packs_epi32(low[i], high[i]);
+}
+
+static inline void transposeAVX2(__m256i v[8]) {
+    const __m256i a0 = _mm256_unpacklo_epi16(v[0], v[1]), a1 = _mm256_unpackhi_epi16(v[0], v[1]);
+    const __m256i a2 = _mm256_unpacklo_epi16(v[2], v[3]), a3 = _mm256_unpackhi_epi16(v[2], v[3]);
+    const __m256i a4 = _mm256_unpacklo_epi16(v[4], v[5]), a5 = _mm256_unpackhi_epi16(v[4], v[5]);
+    const __m256i a6 = _mm256_unpacklo_epi16(v[6], v[7]), a7 = _mm256_unpackhi_epi16(v[6], v[7]);
+
+    const __m256i b0 = _mm256_unpacklo_epi32(a0, a2), b1 = _mm256_unpackhi_epi32(a0, a2);
+    const __m256i b2 = _mm256_unpacklo_epi32(a1, a3), b3 = _mm256_unpackhi_epi32(a1, a3);
+    const __m256i b4 = _mm256_unpacklo_epi32(a4, a6), b5 = _mm256_unpackhi_epi32(a4, a6);
+    const __m256i b6 = _mm256_unpacklo_epi32(a5, a7), b7 = _mm256_unpackhi_epi32(a5, a7);
+
+    v[0] = _mm256_unpacklo_epi64(b0, b4);
+    v[1] = _mm256_unpackhi_epi64(b0, b4);
+    v[2] = _mm256_unpacklo_epi64(b1, b5);
+    v[3] = _mm256_unpackhi_epi64(b1, b5);
+    v[4] = _mm256_unpacklo_epi64(b2, b6);
+    v[5] = _mm256_unpackhi_epi64(b2, b6);
+    v[6] = _mm256_unpacklo_epi64(b3, b7);
+    v[7] = _mm256_unpackhi_epi64(b3, b7);
+}
+
+void inverseDCTBlockPairAVX2(const short* const first, const short* const second, const short* const quantization,
+                             unsigned char* const outFirst, unsigned char* const outSecond, const std::size_t outStride) {
+    // the first block in the low lane and the second in the high lane, dequantized and saturated to 16 bits
+    __m256i rows[8];
+    for (unsigned int y = 0; y < 8; ++y) {
+        const __m256i coefficients = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) (first + y * 8))),
+                                                             _mm_loadu_si128((const __m128i*) (second + y * 8)), 1);
+        const __m256i multipliers = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) (quantization + y * 8)));
+        const __m256i low = _mm256_mullo_epi16(coefficients, multipliers);
+        const __m256i high = _mm256_mulhi_epi16(coefficients, multipliers);
+        rows[y] = _mm256_packs_epi32(_mm256_unpacklo_epi16(low, high), _mm256_unpackhi_epi16(low, high));
+    }
+
+    __m256i workspace[8];
+    idctPassAVX2(rows, pass1Shift, workspace);
+    transposeAVX2(workspace);
+    idctPassAVX2(workspace, pass2Shift, rows);
+
+    // packing to unsigned bytes clamps to 0..255
+    const __m256i center = _mm256_set1_epi16(128);
+    for (unsigned int i = 0; i < 8; ++i)
+        rows[i] = _mm256_add_epi16(rows[i], center);
+    transposeAVX2(rows);
+
+    for (unsigned int y = 0; y < 8; ++y) {
+        const __m256i packed = _mm256_packus_epi16(rows[y], rows[y]);
+        _mm_storel_epi64((__m128i*) (outFirst + y * outStride), _mm256_castsi256_si128(packed));
+        _mm_storel_epi64((__m128i*) (outSecond + y * outStride), _mm256_extracti128_si256(packed, 1));
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef JPEGINCPLUSPLUS_IDCTCONSTANTS_H
+#define JPEGINCPLUSPLUS_IDCTCONSTANTS_H
+
+// Fixed-point constants of the integer IDCT kernels, worked out at compile time from the
+// factors of libjpeg's jidctint.c so every kernel folds in exactly the same values.
+
+constexpr int fixBits = 13;
+constexpr int pass1Bits = 2;
+
+// round(x * 2^fixBits)
+constexpr int fix(const double x) {
+    return (int) (x * (1 << fixBits) + 0.5);
+}
+
+// The textbook factorization is rearranged so that every output of a 1-D pass is
+// a sum of products of the inputs with combined constants. The integer results
+// are identical, and the SIMD kernels can form each sum with pmaddwd.
+//
+// even part:
+//   tmp0 = (in0 + in4) * 8192          tmp1 = (in0 - in4) * 8192
+//   tmp3 = in2 * even26 + in6 * even62
+//   tmp2 = in2 * even62 + in6 * even66
+// odd part, one row of oddWeights per odd output, columns are in7, in1, in3, in5
+
+constexpr int evenDC = 1 << fixBits;
+constexpr int even26 = fix(0.541196100) + fix(0.765366865);
+constexpr int even62 = fix(0.541196100);
+constexpr int even66 = fix(0.541196100) - fix(1.847759065);
+
+// the rotations shared by pairs of odd inputs: z1 = in7 + in1, z2 = in5 + in3,
+// z3 = in7 + in3, z4 = in5 + in1, and z5 = in7 + in1 + in3 + in5
+constexpr int oddZ1 = -fix(0.899976223);
+constexpr int oddZ2 = -fix(2.562915447);
+constexpr int oddZ3 = -fix(1.961570560);
+constexpr int oddZ4 = -fix(0.390180644);
+constexpr int oddZ5 = fix(1.175875602);
+
+constexpr int oddWeights[4][4] = {
+        {fix(0.298631336) + oddZ1 + oddZ3 + oddZ5, oddZ1 + oddZ5, oddZ3 + oddZ5, oddZ5},
+        {oddZ5, oddZ4 + oddZ5, oddZ2 + oddZ5, fix(2.053119869) + oddZ2 + oddZ4 + oddZ5},
+        {oddZ3 + oddZ5, oddZ5, fix(3.072711026) + oddZ2 + oddZ3 + oddZ5, oddZ2 + oddZ5},
+        {oddZ1 + oddZ5, fix(1.501321110) + oddZ1 + oddZ4 + oddZ5, oddZ5, oddZ4 + oddZ5}
+};
+
+constexpr int pass1Shift = fixBits - pass1Bits;
+constexpr int pass2Shift = fixBits + pass1Bits + 3;
+
+#endif //JPEGINCPLUSPLUS_IDCTCONSTANTS_H
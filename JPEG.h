@@ -2,7 +2,11 @@
 // Created by Ashwin Murali on 3/29/21.
 //
 
+#include <array>
+#include <cstddef>
 #include <vector>
+#include "ByteSource.h"
+#include "Stats.h"
 
 #ifndef JPEGINCPLUSPLUS_JPEG_H
 
@@ -20,12 +24,12 @@ const unsigned char SOF7 = 0xC7; // Differential lossless (sequential)
 // Start of Frame markers, non-differential, arithmetic coding
 const unsigned char SOF9 = 0xC9; // Extended sequential DCT
 const unsigned char SOF10 = 0xCA; // Progressive DCT
-const unsigned char SOF21 = 0xCB; // Lossless (sequential)
+const unsigned char SOF11 = 0xCB; // Lossless (sequential)
 
 // Start of Frame markers, differential, arithmetic coding
-const unsigned char SOF13 = 0xC0; // Differential sequential DCT
-const unsigned char SOF14 = 0xC1; // Differential progressive DCT
-const unsigned char SOF15 = 0xC2; // Differential lossless (sequential)
+const unsigned char SOF13 = 0xCD; // Differential sequential DCT
+const unsigned char SOF14 = 0xCE; // Differential progressive DCT
+const unsigned char SOF15 = 0xCF; // Differential lossless (sequential)
 
 //APPn markers
 const unsigned char APP0 = 0xE0;
@@ -88,28 +92,52 @@ const unsigned char JPG13 = 0xFD;
 const unsigned char TEM = 0x01;
 
 
+// why an image could not be read or decoded
+enum class JPEGError {
+    None,
+    FileError,      // the input could not be opened or read
+    OutOfMemory,
+    NotJPEG,        // no SOI marker at the start
+    Truncated,      // the input ended before the image did
+    InvalidMarker,  // unexpected, unknown or malformed marker segment
+    InvalidTable,   // bad quantization or Huffman table, or a reference to a missing one
+    InvalidFrame,   // bad frame or scan header
+    Unsupported,    // valid JPEG features this decoder does not handle
+    InvalidData,    // corrupt entropy-coded data
+    WriteError,     // the output could not be written
+    InvalidArgument // the caller's output buffer or parameters are unusable
+};
+
+// number of bits the Huffman decoder peeks at once; codes up to this length
+// resolve with a single table lookup, longer codes fall back to maxCode
+const unsigned int huffmanLookupBits = 9;
+
 struct HuffmanTable {
 
     unsigned char offsets[17] = {0};
     unsigned char symbols[162] = {0};
+
+    // lookahead table indexed by the next huffmanLookupBits bits of the stream
+    // high byte holds the code length (0 if the code is longer), low byte the symbol
+    alignas(64) unsigned short lookup[1 << huffmanLookupBits] = {0};
+
+    // largest code of each length (-1 if none) and the index into symbols of
+    // the first code of each length, used for codes longer than huffmanLookupBits
+    int maxCode[18] = {0};
+    int valueOffset[17] = {0};
+
     bool set = false;
 
 };
 
-struct MCU {
-    union {
-        int y[64] = {0};
-        int r[64];
-    };
-
-    union {
-        int cb[64] = {0};
-        int g[64];
-    };
-    union {
-        int cr[64] = {0};
-        int b[64];
-    };
+// component count and sampling factors of the layouts the MCU decoder has a loop of its own for:
+// luminance blocks per MCU 1x1, 2x1 or 2x2 with one block of each chroma component
+enum class SamplingLayout {
+    Gray,
+    YCbCr444,
+    YCbCr422,
+    YCbCr420,
+    Other
 };
 
 struct ColorComponent {
@@ -126,10 +154,35 @@ struct ColorComponent {
 struct QuantizationTable {
 
     unsigned int table[64] = {0};
+    // the table as the IDCT multiplies by it, saturated to 16 bits
+    alignas(64) short multipliers[64] = {0};
     bool set = false;
 
 };
 
+// one scan of a progressive image, with the Huffman tables in force when it was read
+struct ScanHeader {
+
+    unsigned char numComponents = 0;
+    // index into Header::colorComponents of each component of the scan, in scan order
+    unsigned char components[3] = {0};
+
+    unsigned char startOfSelection = 0;
+    unsigned char endOfSelection = 0;
+    unsigned char successiveApproximationHigh = 0;
+    unsigned char successiveApproximationLow = 0;
+
+    unsigned int restartInterval = 0;
+
+    // the DC table of each component of a first DC scan, or the AC table of an AC scan
+    HuffmanTable huffmanTables[3];
+
+    // compressed data of the scan inside Header::source, still byte-stuffed and with RSTN markers
+    const unsigned char* data = nullptr;
+    std::size_t length = 0;
+
+};
+
 struct Header {
 
     QuantizationTable quantizationTables[4];
@@ -142,6 +195,21 @@ struct Header {
     unsigned char numComponents = 0;
     bool zeroBased = false;
 
+    // largest sampling factors, giving the MCU size in blocks, and the image size in MCUs
+    unsigned char horizontalSamplingFactor = 1;
+    unsigned char verticalSamplingFactor = 1;
+    unsigned int mcuWidth = 0;
+    unsigned int mcuHeight = 0;
+    SamplingLayout layout = SamplingLayout::Other;
+
+    // size of the decoded image, 1/scale of the frame's in each direction (see setScale),
+    // or the part of that at (cropX, cropY) picked by setCrop
+    unsigned int scale = 1;
+    unsigned int cropX = 0;
+    unsigned int cropY = 0;
+    unsigned int outputWidth = 0;
+    unsigned int outputHeight = 0;
+
     unsigned char startofSelection = 0;
     unsigned endOfSelection = 63;
     unsigned char successiveApproximationHigh = 0;
@@ -151,22 +219,64 @@ struct Header {
 
     ColorComponent colorComponents[3];
 
-    std::vector<unsigned char> huffmanData;
+    // input the header was read from, kept open for the compressed image data
+    ByteSource source;
+
+    // compressed image data inside source, still byte-stuffed and with RSTN markers
+    const unsigned char* huffmanData = nullptr;
+    std::size_t huffmanDataLength = 0;
+
+    // offset into huffmanData of each restart interval after the first; sequential images only
+    std::vector<std::size_t> restartOffsets;
+
+    // progressive images only: every scan, in file order, huffmanData spanning them all
+    std::vector<ScanHeader> scans;
+
+    bool valid = true;
+    // first problem found once valid is false
+    JPEGError error = JPEGError::None;
+
+    // reading and parsing so far; decodeImage adds the decoding stages to a copy
+    DecodeStats stats;
 
+};
+
+// what probeJPG learns from the markers before the first scan
+struct JPEGInfo {
+
+    unsigned char frameType = 0;
+    unsigned int height = 0;
+    unsigned int width = 0;
+    unsigned char numComponents = 0;
+    // as the frame header codes them, sampling factors of a single component included
+    ColorComponent colorComponents[3];
+    unsigned int restartInterval = 0;
     bool valid = true;
+    JPEGError error = JPEGError::None;
 
 };
 
-const unsigned int zigZagMap[] = {
-        0, 1, 8, 16, 9, 2, 3, 10,
-        17, 24, 32, 25, 18, 11, 4, 5,
-        12, 19, 26, 33, 40, 48, 41, 34,
-        27, 20, 13, 6, 7, 14, 21, 28,
-        35, 42, 49, 56, 57, 50, 43, 36,
-        29, 22, 15, 23, 30, 37, 44, 51,
-        58, 59, 52, 45, 38, 31, 39, 46,
-        53, 60, 61, 54, 47, 55, 62, 63
-} ;
+// natural-order index of each zig-zag position: the anti-diagonals of the block,
+// walked up and to the right on even ones and down and to the left on odd ones
+constexpr std::array<unsigned char, 64> makeZigZagMap() {
+    std::array<unsigned char, 64> map{};
+    unsigned int k = 0;
+    for (int diagonal = 0; diagonal < 15; ++diagonal) {
+        const int first = diagonal < 8 ? 0 : diagonal - 7;
+        const int last = diagonal < 8 ? diagonal : 7;
+        for (int i = first; i <= last; ++i) {
+            const int row = diagonal % 2 == 0 ? diagonal - i : i;
+            map[k++] = (unsigned char) (row * 8 + diagonal - row);
+        }
+    }
+    return map;
+}
+
+// one cache line, shared by every translation unit
+alignas(64) inline constexpr std::array<unsigned char, 64> zigZagMap = makeZigZagMap();
+
+static_assert(zigZagMap[2] == 8 && zigZagMap[3] == 16 && zigZagMap[61] == 55 && zigZagMap[62] == 62,
+              "zig-zag order does not match T.81 Figure A.6");
 
 
 #define JPEGINCPLUSPLUS_JPEG_H
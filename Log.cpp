@@ -0,0 +1,25 @@
+#include "Log.h"
+#include <atomic>
+#include <cstdio>
+
+static std::atomic<int> currentLevel(static_cast<int>(LogLevel::Silent));
+
+void setLogLevel(const LogLevel level) {
+    currentLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+LogLevel getLogLevel() {
+    return static_cast<LogLevel>(currentLevel.load(std::memory_order_relaxed));
+}
+
+void writeLog(const LogLevel level, const std::string& message) {
+    std::string line;
+    if (level == LogLevel::Error)
+        line = "Error - ";
+    else if (level == LogLevel::Warning)
+        line = "Warning - ";
+    line += message;
+    line += '\n';
+    // stdio locks the stream for the whole call
+    std::fwrite(line.data(), 1, line.size(), stderr);
+}
@@ -0,0 +1,44 @@
+#ifndef JPEGINCPLUSPLUS_LOG_H
+#define JPEGINCPLUSPLUS_LOG_H
+
+#include <sstream>
+#include <string>
+
+// Diagnostics from the decoder. Messages above JPEG_MAX_LOG_LEVEL are compiled
+// out entirely; the rest are checked against a runtime level, which starts at
+// Silent, so by default the decoder does no stream I/O at all. Enabled messages
+// go to stderr, one write per line, so lines from different threads never mix.
+
+enum class LogLevel {
+    Silent,
+    Error,
+    Warning,
+    Info,
+    Debug
+};
+
+#ifndef JPEG_MAX_LOG_LEVEL
+#define JPEG_MAX_LOG_LEVEL 4
+#endif
+
+void setLogLevel(LogLevel level);
+LogLevel getLogLevel();
+
+void writeLog(LogLevel level, const std::string& message);
+
+// message is anything that can be streamed, e.g. "Invalid marker: 0x" << std::hex << marker
+#define JPEG_LOG(level, message)                                                   \
+    do {                                                                           \
+        if (static_cast<int>(level) <= JPEG_MAX_LOG_LEVEL && (level) <= getLogLevel()) { \
+            std::ostringstream jpegLogStream;                                      \
+            jpegLogStream << message;                                              \
+            writeLog(level, jpegLogStream.str());                                  \
+        }                                                                          \
+    } while (false)
+
+#define JPEG_LOG_ERROR(message) JPEG_LOG(LogLevel::Error, message)
+#define JPEG_LOG_WARNING(message) JPEG_LOG(LogLevel::Warning, message)
+#define JPEG_LOG_INFO(message) JPEG_LOG(LogLevel::Info, message)
+#define JPEG_LOG_DEBUG(message) JPEG_LOG(LogLevel::Debug, message)
+
+#endif //JPEGINCPLUSPLUS_LOG_H
@@ -0,0 +1,490 @@
+#include "Decoder.h"
+#include "ThreadPool.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// what happened to one input file
+struct FileResult {
+    std::string filename;
+    JPEGError error = JPEGError::None;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int numComponents = 0;
+    std::size_t bytesRead = 0;
+    DecodeStats stats;
+};
+
+// container of the decoded image
+enum class OutputFormat {
+    BMP,
+    // binary PPM, or PGM for the luminance alone
+    PNM,
+    // headerless RGB24 or GRAY8 pixels
+    Raw
+};
+
+// how much of each image to decode and where it goes
+struct OutputOptions {
+    // stop after this many scans of a progressive image, unless 0
+    unsigned int numScans = 0;
+    // write the image at 1/scale of its size
+    unsigned int scale = 1;
+    // write only the cropWidth x cropHeight pixels at (cropX, cropY) of that, unless cropWidth is 0
+    unsigned int cropX = 0;
+    unsigned int cropY = 0;
+    unsigned int cropWidth = 0;
+    unsigned int cropHeight = 0;
+    // write the luminance only (always so for grayscale images)
+    bool gray = false;
+    OutputFormat format = OutputFormat::BMP;
+    // write to this file, or "-" for stdout, instead of one named after the input; single images only
+    std::string outputPath;
+    // write to this already open file descriptor instead, unless -1
+    int outputFD = -1;
+};
+
+// file extension of the output for an image written in full color or gray
+std::string outputExtension(const OutputFormat format, const bool gray) {
+    switch (format) {
+        case OutputFormat::BMP:
+            return ".bmp";
+        case OutputFormat::PNM:
+            return gray ? ".pgm" : ".ppm";
+        case OutputFormat::Raw:
+            return gray ? ".gray" : ".rgb";
+    }
+    return "";
+}
+
+// decode filename to a file next to it in options.format, or to options.outputPath or options.outputFD
+JPEGError decodeFile(const std::string& filename, const bool verbose, const unsigned int numThreads, const OutputOptions& options,
+                     FileResult& result) {
+    // one context and writer per thread, their buffers reused for every file it decodes
+    static thread_local DecoderContext context;
+    static thread_local BMPWriter bmpWriter;
+    static thread_local StreamWriter streamWriter;
+
+    result.filename = filename;
+    const Header* const header = context.read(filename);
+    result.bytesRead = header->source.size();
+    result.stats = header->stats;
+
+    if (!header->valid)
+        return result.error = header->error;
+    context.setScale(options.scale);
+    if (options.cropWidth != 0 && !context.setCrop(options.cropX, options.cropY, options.cropWidth, options.cropHeight)) {
+        JPEG_LOG_ERROR("Crop window outside the image");
+        return result.error = JPEGError::InvalidArgument;
+    }
+    result.width = header->outputWidth;
+    result.height = header->outputHeight;
+    result.numComponents = header->numComponents;
+
+    if (verbose)
+        printHeader(header);
+
+    // write the output as the image is decoded
+    const bool gray = options.gray || header->numComponents == 1;
+    std::string outFilename = options.outputPath;
+    if (outFilename.empty()) {
+        const std::string extension = outputExtension(options.format, gray);
+        const std::size_t pos = filename.find_last_of('.');
+        outFilename = (pos == std::string::npos) ? (filename + extension) : (filename.substr(0, pos) + extension);
+    }
+    DecodeStats* const stats = &result.stats;
+    const bool stream = options.format != OutputFormat::BMP;
+    BandWriter& writer = stream ? (BandWriter&) streamWriter : bmpWriter;
+    // the descriptor the stream writes to, closed here only if opened here
+    int fd = options.outputFD;
+    bool ownFD = false;
+    bool opened;
+    {
+        JPEG_STATS_TIMER(stats, write);
+        if (stream) {
+            if (fd < 0 && outFilename == "-") {
+                fd = STDOUT_FILENO;
+            }
+            else if (fd < 0) {
+                fd = ::open(outFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                ownFD = fd >= 0;
+                if (fd < 0)
+                    JPEG_LOG_ERROR("Error opening " << outFilename);
+            }
+            opened = fd >= 0 && streamWriter.open(fd, header->outputWidth, header->outputHeight,
+                                                  gray ? PixelFormat::GRAY8 : PixelFormat::RGB24,
+                                                  options.format == OutputFormat::PNM);
+        }
+        else {
+            opened = bmpWriter.open(outFilename, header->outputWidth, header->outputHeight, gray);
+        }
+    }
+    result.error = JPEGError::WriteError;
+    if (opened)
+        result.error = options.numScans != 0 ? context.decodePreview(options.numScans, writer, stats) : context.decode(writer, numThreads, stats);
+    JPEG_STATS_TIMER(stats, write);
+    bool closed = true;
+    if (!stream && opened)
+        closed = bmpWriter.close();
+    if (ownFD)
+        closed = ::close(fd) == 0;
+    if (!closed && result.error == JPEGError::None)
+        result.error = JPEGError::WriteError;
+    return result.error;
+}
+
+void writeJSONString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if ((unsigned char) c < 0x20) {
+            const char* const digits = "0123456789abcdef";
+            out << "\\u00" << digits[(c >> 4) & 0xF] << digits[c & 0xF];
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void writeJSONStats(std::ostream& out, const DecodeStats& stats, const std::string& indent) {
+    out << indent << "\"seconds\": {\"fileRead\": " << stats.fileRead << ", \"markerParse\": " << stats.markerParse
+        << ", \"entropyDecode\": " << stats.entropyDecode << ", \"dequantIDCT\": " << stats.dequantIDCT
+        << ", \"colorConvert\": " << stats.colorConvert << ", \"write\": " << stats.write
+        << ", \"total\": " << stats.total() << "},\n";
+    out << indent << "\"bytesIn\": " << stats.bytesIn << ", \"pixelsOut\": " << stats.pixelsOut << ", \"mcus\": " << stats.mcus
+        << ", \"restartIntervals\": " << stats.restartIntervals << ", \"allocations\": " << stats.allocations;
+}
+
+// per-file and aggregate statistics as one JSON document
+void printStatsJSON(std::ostream& out, const std::vector<FileResult>& results, const double seconds, const unsigned int numWorkers) {
+    out.precision(9);
+    out << "{\n  \"files\": [";
+    DecodeStats aggregate;
+    std::size_t failed = 0;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const FileResult& result = results[i];
+        aggregate += result.stats;
+        failed += result.error != JPEGError::None;
+
+        out << (i == 0 ? "\n" : ",\n") << "    {\n      \"file\": ";
+        writeJSONString(out, result.filename);
+        out << ",\n      \"ok\": " << (result.error == JPEGError::None ? "true" : "false");
+        if (result.error != JPEGError::None) {
+            out << ", \"error\": ";
+            writeJSONString(out, errorString(result.error));
+        }
+        out << ",\n      \"width\": " << result.width << ", \"height\": " << result.height
+                  << ", \"components\": " << result.numComponents << ",\n";
+        writeJSONStats(out, result.stats, "      ");
+        out << "\n    }";
+    }
+    out << "\n  ],\n  \"aggregate\": {\n    \"files\": " << results.size() << ", \"failed\": " << failed
+              << ", \"threads\": " << numWorkers << ", \"wallSeconds\": " << seconds << ",\n";
+    writeJSONStats(out, aggregate, "    ");
+    out << "\n  }\n}\n";
+}
+
+bool hasJPEGExtension(const std::string& filename) {
+    const std::size_t pos = filename.find_last_of('.');
+    if (pos == std::string::npos)
+        return false;
+    std::string extension = filename.substr(pos + 1);
+    for (char& c : extension)
+        c = (char) std::tolower((unsigned char) c);
+    return extension == "jpg" || extension == "jpeg" || extension == "jpe" || extension == "jfif";
+}
+
+// add every JPEG below directory, in sorted order so runs are repeatable
+void listDirectory(const std::string& directory, std::vector<std::string>& filenames) {
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        JPEG_LOG_ERROR("Error opening directory " << directory);
+        return;
+    }
+    std::vector<std::string> entries;
+    while (const dirent* entry = readdir(dir)) {
+        const std::string name(entry->d_name);
+        if (name != "." && name != "..")
+            entries.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+
+    for (const std::string& path : entries) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode))
+            listDirectory(path, filenames);
+        else if (S_ISREG(info.st_mode) && hasJPEGExtension(path))
+            filenames.push_back(path);
+    }
+}
+
+// one path per line, blank lines ignored
+bool readFileList(const std::string& listFilename, std::vector<std::string>& filenames) {
+    std::ifstream listFile(listFilename);
+    if (!listFile) {
+        JPEG_LOG_ERROR("Error opening file list " << listFilename);
+        return false;
+    }
+    std::string line;
+    while (std::getline(listFile, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            filenames.push_back(line);
+    }
+    return true;
+}
+
+// print one line of metadata per file without decoding anything
+bool probeFiles(const std::vector<std::string>& filenames) {
+    bool success = true;
+    for (const std::string& filename : filenames) {
+        const JPEGInfo info = probeJPG(filename);
+        if (!info.valid) {
+            std::cout << filename << ": " << errorString(info.error) << "\n";
+            success = false;
+            continue;
+        }
+        std::cout << filename << ": " << (info.frameType == SOF2 ? "progressive " : "") << info.width << "x" << info.height << ", "
+                  << (unsigned int) info.numComponents << " component" << (info.numComponents == 1 ? "" : "s") << ", sampling";
+        for (unsigned int i = 0; i < info.numComponents; ++i) {
+            std::cout << (i == 0 ? " " : ",") << (unsigned int) info.colorComponents[i].horizontalSamplingFactor << "x"
+                      << (unsigned int) info.colorComponents[i].verticalSamplingFactor;
+        }
+        std::cout << ", restart interval " << info.restartInterval << "\n";
+    }
+    return success;
+}
+
+void printUsage() {
+    std::cout << "Usage: JPEGinCPlusPlus [options] <file.jpg | directory>...\n"
+              << "  --crop=WxH+X+Y only decode the W by H pixels at X, Y (after scaling)\n"
+              << "  --format=F     write F: bmp (default), pnm (binary PPM, or PGM for gray) or raw\n"
+              << "                 (headerless RGB or gray pixels); pnm and raw stream top-down as decoded\n"
+              << "  --gray         write the luminance only, as an 8-bit BMP, a PGM or raw gray samples\n"
+              << "  --list=FILE    also decode the paths listed in FILE, one per line\n"
+              << "  --output=FILE  write a single image to FILE, or with pnm and raw to stdout if FILE is -\n"
+              << "  --output-fd=N  write a single image in pnm or raw to the open file descriptor N\n"
+              << "  --probe        only print each file's dimensions and layout\n"
+              << "  --quiet        do not report errors\n"
+              << "  --scale=N      decode at 1/N of the size, N being 2, 4 or 8\n"
+              << "  --scans=N      write progressive images as decoded from their first N scans only\n"
+              << "  --stats=json   print per-file and aggregate timings and counters as JSON\n"
+              << "  --verbose      report every marker read and print the tables of a single file\n"
+              << "  --threads=N    decode up to N files at once (default: one per core)\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> filenames;
+    unsigned int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    bool batch = false;
+    bool probe = false;
+    bool verbose = false;
+    bool statsJSON = false;
+    OutputOptions options;
+    // errors only, on stderr, unless asked otherwise
+    setLogLevel(LogLevel::Error);
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg.compare(0, 7, "--list=") == 0) {
+            if (!readFileList(arg.substr(7), filenames))
+                return 1;
+            batch = true;
+        }
+        else if (arg.compare(0, 10, "--threads=") == 0) {
+            const int value = std::atoi(arg.c_str() + 10);
+            if (value <= 0) {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+            numWorkers = (unsigned int) value;
+            batch = true;
+        }
+        else if (arg.compare(0, 8, "--scans=") == 0) {
+            const int value = std::atoi(arg.c_str() + 8);
+            if (value <= 0) {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+            options.numScans = (unsigned int) value;
+        }
+        else if (arg.compare(0, 7, "--crop=") == 0) {
+            char end;
+            if (std::sscanf(arg.c_str() + 7, "%ux%u+%u+%u%c", &options.cropWidth, &options.cropHeight, &options.cropX, &options.cropY, &end) != 4 ||
+                options.cropWidth == 0 || options.cropHeight == 0) {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 8, "--scale=") == 0) {
+            const int value = std::atoi(arg.c_str() + 8);
+            if (value != 1 && value != 2 && value != 4 && value != 8) {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+            options.scale = (unsigned int) value;
+        }
+        else if (arg == "--gray") {
+            options.gray = true;
+        }
+        else if (arg.compare(0, 9, "--format=") == 0) {
+            const std::string value = arg.substr(9);
+            if (value == "bmp") {
+                options.format = OutputFormat::BMP;
+            }
+            else if (value == "pnm") {
+                options.format = OutputFormat::PNM;
+            }
+            else if (value == "raw") {
+                options.format = OutputFormat::Raw;
+            }
+            else {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 9, "--output=") == 0) {
+            options.outputPath = arg.substr(9);
+            if (options.outputPath.empty()) {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 12, "--output-fd=") == 0) {
+            char* end;
+            const long value = std::strtol(arg.c_str() + 12, &end, 10);
+            if (end == arg.c_str() + 12 || *end != '\0' || value < 0 || value > 65535) {
+                std::cout << "Invalid arguments\n";
+                return 1;
+            }
+            options.outputFD = (int) value;
+        }
+        else if (arg == "--probe") {
+            probe = true;
+        }
+        else if (arg == "--stats=json") {
+#ifdef JPEG_ENABLE_STATS
+            statsJSON = true;
+#else
+            JPEG_LOG_ERROR("Statistics are not compiled in (JPEG_ENABLE_STATS)");
+            return 1;
+#endif
+        }
+        else if (arg == "--quiet") {
+            setLogLevel(LogLevel::Silent);
+        }
+        else if (arg == "--verbose") {
+            setLogLevel(LogLevel::Debug);
+            verbose = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            printUsage();
+            return 1;
+        }
+        else {
+            struct stat info;
+            if (stat(arg.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+                listDirectory(arg, filenames);
+                batch = true;
+            }
+            else {
+                filenames.push_back(arg);
+            }
+        }
+    }
+    if (filenames.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    if (probe)
+        return probeFiles(filenames) ? 0 : 1;
+
+    if ((!options.outputPath.empty() || options.outputFD >= 0) && (batch || filenames.size() != 1)) {
+        JPEG_LOG_ERROR("--output and --output-fd take a single image");
+        return 1;
+    }
+    if ((options.outputFD >= 0 || options.outputPath == "-") && options.format == OutputFormat::BMP) {
+        JPEG_LOG_ERROR("BMP output needs a file, use --format=pnm or --format=raw to stream");
+        return 1;
+    }
+    // the image itself may go to stdout, so everything else goes to stderr then
+    const bool toStdout = options.outputFD == STDOUT_FILENO || (options.outputFD < 0 && options.outputPath == "-");
+    if (toStdout && verbose) {
+        JPEG_LOG_ERROR("--verbose prints to stdout, which the image is written to");
+        return 1;
+    }
+
+    // a single image keeps the old behaviour and may use every core on its restart intervals
+    if (!batch && filenames.size() == 1) {
+        std::vector<FileResult> results(1);
+        const auto start = std::chrono::steady_clock::now();
+        const JPEGError error = decodeFile(filenames[0], verbose, std::max(1u, std::thread::hardware_concurrency()), options, results[0]);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (error != JPEGError::None)
+            JPEG_LOG_ERROR(filenames[0] << ": " << errorString(error));
+        if (statsJSON)
+            printStatsJSON(toStdout ? std::cerr : std::cout, results, seconds, 1);
+        return error == JPEGError::None ? 0 : 1;
+    }
+
+    // batch: one file per task, files decoded concurrently rather than split up
+    numWorkers = std::min(numWorkers, (unsigned int) filenames.size());
+    // each task fills in its own slot
+    std::vector<FileResult> results(filenames.size());
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(numWorkers);
+        for (std::size_t i = 0; i < filenames.size(); ++i) {
+            pool.submit([&, i] {
+                decodeFile(filenames[i], false, numWorkers == 1 ? std::max(1u, std::thread::hardware_concurrency()) : 1, options, results[i]);
+            });
+        }
+        pool.wait();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::size_t failed = 0;
+    std::size_t totalBytes = 0;
+    for (const FileResult& result : results) {
+        totalBytes += result.bytesRead;
+        failed += result.error != JPEGError::None;
+    }
+
+    if (statsJSON) {
+        printStatsJSON(std::cout, results, seconds, numWorkers);
+        return failed == 0 ? 0 : 1;
+    }
+
+    for (const FileResult& result : results) {
+        if (result.error != JPEGError::None)
+            std::cout << "Failed: " << result.filename << " (" << errorString(result.error) << ")\n";
+    }
+
+    std::cout << "Decoded " << filenames.size() - failed << " of " << filenames.size() << " files with " << numWorkers
+              << (numWorkers == 1 ? " thread in " : " threads in ") << seconds << " s";
+    if (seconds > 0.0)
+        std::cout << " (" << filenames.size() / seconds << " files/s, " << totalBytes / seconds / 1e6 << " MB/s)";
+    std::cout << "\n";
+    return failed == 0 ? 0 : 1;
+}
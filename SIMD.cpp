@@ -0,0 +1,17 @@
+#include "SIMD.h"
+
+SIMDLevel bestSIMDLevel() {
+#ifdef JPEG_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return SIMDLevel::AVX2;
+#endif
+#if defined(__SSE2__)
+    return SIMDLevel::SSE2;
+#else
+    return SIMDLevel::Scalar;
+#endif
+}
+
+bool supportsSIMDLevel(const SIMDLevel level) {
+    return level <= bestSIMDLevel();
+}
@@ -0,0 +1,18 @@
+#ifndef JPEGINCPLUSPLUS_SIMD_H
+#define JPEGINCPLUSPLUS_SIMD_H
+
+// Instruction sets the SIMD kernels are written for. AVX2 kernels are built in
+// separate files with -mavx2 (JPEG_HAVE_AVX2) and only used after a runtime CPU check.
+enum class SIMDLevel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// the best level the build and the running CPU both support
+SIMDLevel bestSIMDLevel();
+
+// true if kernels for level can run here
+bool supportsSIMDLevel(SIMDLevel level);
+
+#endif //JPEGINCPLUSPLUS_SIMD_H
@@ -0,0 +1,84 @@
+#ifndef JPEGINCPLUSPLUS_STATS_H
+#define JPEGINCPLUSPLUS_STATS_H
+
+#include <chrono>
+#include <cstdint>
+
+// Where the time goes for one image, and what the image made the decoder do.
+// The timers and counters below are only compiled in with JPEG_ENABLE_STATS;
+// without it the macros compile to nothing, though they still use their arguments
+// (unevaluated) so nothing is left unused, and every field stays zero.
+struct DecodeStats {
+    // seconds per stage
+    double fileRead = 0.0;
+    double markerParse = 0.0;
+    double entropyDecode = 0.0;
+    double dequantIDCT = 0.0;
+    double colorConvert = 0.0;
+    // output, whichever format it is written in
+    double write = 0.0;
+
+    std::uint64_t bytesIn = 0;
+    std::uint64_t pixelsOut = 0;
+    std::uint64_t mcus = 0;
+    std::uint64_t restartIntervals = 0;
+    // buffers the decoder had to allocate or grow
+    std::uint64_t allocations = 0;
+
+    double total() const {
+        return fileRead + markerParse + entropyDecode + dequantIDCT + colorConvert + write;
+    }
+
+    DecodeStats& operator+=(const DecodeStats& other) {
+        fileRead += other.fileRead;
+        markerParse += other.markerParse;
+        entropyDecode += other.entropyDecode;
+        dequantIDCT += other.dequantIDCT;
+        colorConvert += other.colorConvert;
+        write += other.write;
+        bytesIn += other.bytesIn;
+        pixelsOut += other.pixelsOut;
+        mcus += other.mcus;
+        restartIntervals += other.restartIntervals;
+        allocations += other.allocations;
+        return *this;
+    }
+};
+
+// adds the lifetime of the timer to *seconds, if seconds is not null
+class ScopedTimer {
+public:
+    explicit ScopedTimer(double* const seconds) : seconds(seconds), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        if (seconds != nullptr)
+            *seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    double* const seconds;
+    const std::chrono::steady_clock::time_point start;
+};
+
+#define JPEG_STATS_CONCAT_(a, b) a##b
+#define JPEG_STATS_CONCAT(a, b) JPEG_STATS_CONCAT_(a, b)
+
+#ifdef JPEG_ENABLE_STATS
+// time the rest of the enclosing scope into stats->field; stats may be null
+#define JPEG_STATS_TIMER(stats, field) \
+    ScopedTimer JPEG_STATS_CONCAT(jpegStatsTimer, __LINE__)((stats) != nullptr ? &(stats)->field : nullptr)
+#define JPEG_STATS_ADD(stats, field, value)   \
+    do {                                      \
+        if ((stats) != nullptr)               \
+            (stats)->field += (value);        \
+    } while (false)
+#else
+// the arguments still name their variables, unevaluated, so compiling the stats out leaves none unused
+#define JPEG_STATS_TIMER(stats, field) (void) sizeof((stats)->field)
+#define JPEG_STATS_ADD(stats, field, value) (void) sizeof((stats)->field += (value))
+#endif
+
+#endif //JPEGINCPLUSPLUS_STATS_H
@@ -0,0 +1,95 @@
+#include "ThreadPool.h"
+
+// the pool and worker index of the calling thread, if it is a pool worker
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local unsigned int currentWorker = 0;
+
+ThreadPool::ThreadPool(unsigned int numThreads) {
+    if (numThreads == 0)
+        numThreads = 1;
+    for (unsigned int i = 0; i < numThreads; ++i)
+        queues.emplace_back(new Queue);
+    for (unsigned int i = 0; i < numThreads; ++i)
+        workers.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    std::size_t target;
+    {
+        // counted before it is pushed, so a worker taking it can never count it down first
+        std::lock_guard<std::mutex> lock(stateMutex);
+        target = (currentPool == this) ? currentWorker : nextQueue++ % queues.size();
+        ++queued;
+        ++pending;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::takeTask(const unsigned int self, std::function<void()>& task) {
+    // newest task from our own deque first
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    // otherwise the oldest task of another worker
+    for (std::size_t i = 1; i < queues.size(); ++i) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(const unsigned int self) {
+    currentPool = this;
+    currentWorker = self;
+
+    while (true) {
+        std::function<void()> task;
+        if (takeTask(self, task)) {
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                --queued;
+            }
+            task();
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--pending == 0)
+                idle.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        wake.wait(lock, [this] { return queued != 0 || stopping; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef JPEGINCPLUSPLUS_THREADPOOL_H
+#define JPEGINCPLUSPLUS_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker runs tasks
+// from the back of its own deque and, once that is empty, steals from the front
+// of the others', so a mix of short and long tasks keeps every worker busy.
+// Tasks submitted from inside a worker go to that worker's own deque.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // block until every submitted task has finished
+    void wait();
+
+    unsigned int size() const {
+        return (unsigned int) workers.size();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool takeTask(unsigned int self, std::function<void()>& task);
+    void run(unsigned int self);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::size_t nextQueue = 0;
+
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    // tasks sitting in a deque, and tasks submitted but not yet finished
+    std::size_t queued = 0;
+    std::size_t pending = 0;
+    bool stopping = false;
+};
+
+#endif //JPEGINCPLUSPLUS_THREADPOOL_H